@@ -0,0 +1,117 @@
+//
+//  BatchMatcher.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef BatchMatcher_h
+#define BatchMatcher_h
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/// One bit per matched record, packed in 64 bit words.
+class ResultBitmap {
+  std::vector<uint64_t> _words;
+  size_t _size = 0;
+
+public:
+  ResultBitmap() = default;
+  explicit ResultBitmap(size_t size) { resize(size); }
+
+  void resize(size_t size) {
+    _size = size;
+    _words.assign((size + 63) / 64, 0);
+  }
+
+  size_t size() const noexcept { return _size; }
+  uint64_t *words() noexcept { return _words.data(); }
+  const uint64_t *words() const noexcept { return _words.data(); }
+
+  bool test(size_t i) const noexcept {
+    assert(i < _size && "Out of bounds");
+    return (_words[i / 64] >> (i % 64)) & 1;
+  }
+
+  void set(size_t i, bool value) noexcept {
+    assert(i < _size && "Out of bounds");
+    const auto bit = uint64_t(1) << (i % 64);
+    _words[i / 64] = value ? _words[i / 64] | bit : _words[i / 64] & ~bit;
+  }
+
+  size_t count() const noexcept {
+    size_t total = 0;
+    for (const auto word : _words) {
+      total += __builtin_popcountll(word);
+    }
+    return total;
+  }
+};
+
+/// Matches batches of records against a shared state machine on a work
+/// stealing thread pool.
+///
+/// Any machine with a `const` `accept(std::string_view)` can be used, e.g.
+/// `Machine` or `CompiledMachine`; it is shared by all workers, not copied.
+/// Records are split in chunks that fill whole cache lines of the result
+/// bitmap, so no two workers ever write to the same line.
+class BatchMatcher {
+public:
+  /// Records covered by one 64 byte line of the result bitmap.
+  static constexpr size_t kRecordsPerLine = 64 * 8;
+
+private:
+  WorkStealingPool _pool;
+  size_t _chunkSize;
+
+public:
+  /// `threadCount` of zero uses one worker per hardware thread. The chunk
+  /// size is rounded up to a whole number of bitmap cache lines.
+  explicit BatchMatcher(size_t threadCount = 0,
+                        size_t chunkSize = 8 * kRecordsPerLine)
+      : _pool(threadCount),
+        _chunkSize(std::max(kRecordsPerLine,
+                            (chunkSize + kRecordsPerLine - 1) /
+                                kRecordsPerLine * kRecordsPerLine)) {}
+
+  size_t threadCount() const noexcept { return _pool.threadCount(); }
+  size_t chunkSize() const noexcept { return _chunkSize; }
+  WorkStealingPool &pool() noexcept { return _pool; }
+
+  /// Sets bit `i` of `results` to whether `inputs[i]` is accepted.
+  template <class StateMachine>
+  void acceptAll(const StateMachine &machine, const std::string_view *inputs,
+                 size_t count, ResultBitmap &results) {
+    results.resize(count);
+    auto *words = results.words();
+    const auto chunks = (count + _chunkSize - 1) / _chunkSize;
+    _pool.parallelFor(chunks, [&](size_t chunk) {
+      const auto begin = chunk * _chunkSize;
+      const auto end = std::min(count, begin + _chunkSize);
+      for (auto i = begin; i < end; i += 64) {
+        // Build each word locally and store it once.
+        uint64_t word = 0;
+        const auto wordEnd = std::min(end, i + 64);
+        for (auto j = i; j < wordEnd; ++j) {
+          word |= uint64_t(machine.accept(inputs[j])) << (j - i);
+        }
+        words[i / 64] = word;
+      }
+    });
+  }
+
+  template <class StateMachine>
+  ResultBitmap acceptAll(const StateMachine &machine,
+                         const std::vector<std::string_view> &inputs) {
+    ResultBitmap results;
+    acceptAll(machine, inputs.data(), inputs.size(), results);
+    return results;
+  }
+};
+
+#endif /* BatchMatcher_h */
@@ -0,0 +1,112 @@
+//
+//  ExampleMachines.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef ExampleMachines_h
+#define ExampleMachines_h
+
+#include "StaticMachine.h"
+
+// The machines the tests and benchmarks run, built at compile time.
+
+// 01, 10, 001, 110 ... 111110000, 00001111
+// A finite state machine that starts in zeros and ends in ones
+// or starts in ones and ends in zeros
+inline constexpr auto k01s10s = [] {
+  StaticMachine<6, 2> machine("01", /*startState=*/0, /*finalStates=*/{3, 4});
+  machine.addTransition(0, '0', 1);
+  machine.addTransition(0, '1', 2);
+
+  machine.addTransition(1, '0', 1);
+  machine.addTransition(1, '1', 3);
+
+  machine.addTransition(2, '0', 4);
+  machine.addTransition(2, '1', 2);
+
+  machine.addTransition(3, '0', 5);
+  machine.addTransition(3, '1', 3);
+
+  machine.addTransition(4, '0', 4);
+  machine.addTransition(4, '1', 5);
+
+  // Dead state
+  machine.addTransition(5, '0', 5);
+  machine.addTransition(5, '1', 5);
+
+  return machine;
+}();
+
+// A finite state machine starts in arbitrary 1's and 0' and ends with one or
+// more zeros
+inline constexpr auto kEndInZeros = [] {
+  StaticMachine<2, 2> machine("01", /*startState=*/0, /*finalStates=*/{1});
+  machine.addTransition(0, '0', 1);
+  machine.addTransition(0, '1', 0);
+
+  machine.addTransition(1, '0', 1);
+  machine.addTransition(1, '1', 0);
+
+  return machine;
+}();
+
+// A finite state machine that contains either ..0100.. or ..0111..
+inline constexpr auto kContainsEither0100or0111 = [] {
+  StaticMachine<7, 2> machine("01", /*startState=*/0,
+                              /*finalStates=*/{4, 6});
+
+  machine.addTransition(0, '0', 1);
+  machine.addTransition(0, '1', 0);
+
+  machine.addTransition(1, '0', 1);
+  machine.addTransition(1, '1', 2);
+
+  machine.addTransition(2, '0', 3);
+  machine.addTransition(2, '1', 5);
+
+  machine.addTransition(3, '0', 4);
+  machine.addTransition(3, '1', 2);
+
+  machine.addTransition(4, '0', 4);
+  machine.addTransition(4, '1', 4);
+
+  machine.addTransition(5, '0', 1);
+  machine.addTransition(5, '1', 6);
+
+  machine.addTransition(6, '0', 6);
+  machine.addTransition(6, '1', 6);
+
+  return machine;
+}();
+
+// A finite state machine that contains either ..abc..
+inline constexpr auto kContainsAbc = [] {
+  StaticMachine<4, 3> machine("abc", /*startState=*/0, /*finalStates=*/{3});
+
+  machine.addTransition(0, 'a', 1);
+  machine.addTransition(0, 'b', 0);
+  machine.addTransition(0, 'c', 0);
+
+  machine.addTransition(1, 'a', 1);
+  machine.addTransition(1, 'b', 2);
+  machine.addTransition(1, 'c', 0);
+
+  machine.addTransition(2, 'a', 1);
+  machine.addTransition(2, 'b', 0);
+  machine.addTransition(2, 'c', 3);
+
+  machine.addTransition(3, 'a', 3);
+  machine.addTransition(3, 'b', 3);
+  machine.addTransition(3, 'c', 3);
+
+  return machine;
+}();
+
+static_assert(k01s10s.isValid() && kEndInZeros.isValid() &&
+                  kContainsEither0100or0111.isValid() &&
+                  kContainsAbc.isValid(),
+              "Malformed machine");
+
+#endif /* ExampleMachines_h */
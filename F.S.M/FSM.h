@@ -8,18 +8,191 @@
 #ifndef FSM_h
 #define FSM_h
 
+#include "Probe.h"
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+class Machine;
+class MachineFile;
+class ParallelBuilder;
+
+/// A partition of the 256 byte values into classes, numbered from 0 in the
+/// order of their smallest byte. Starts with every byte in one class.
+class ByteClasses {
+  std::array<uint8_t, 256> _classes{};
+  size_t _count = 1;
+
+public:
+  size_t count() const noexcept { return _count; }
+  const std::array<uint8_t, 256> &table() const noexcept { return _classes; }
+  uint8_t operator[](unsigned char byte) const noexcept {
+    return _classes[byte];
+  }
+
+  /// Splits classes so that bytes sharing a class also share
+  /// `valueOf(byte)`, a value of at most 32 bits.
+  template <class ValueOf> void refine(ValueOf valueOf) {
+    if (_count == 256) {
+      return;
+    }
+    std::unordered_map<uint64_t, uint8_t> refined;
+    for (size_t byte = 0; byte < 256; ++byte) {
+      const auto key = uint64_t(_classes[byte]) << 32 |
+                       static_cast<uint32_t>(valueOf(byte));
+      _classes[byte] =
+          refined.emplace(key, static_cast<uint8_t>(refined.size()))
+              .first->second;
+    }
+    _count = refined.size();
+  }
+
+  /// The smallest byte of each class.
+  std::vector<unsigned char> representatives() const {
+    std::vector<unsigned char> bytes(_count);
+    for (size_t byte = 256; byte-- > 0;) {
+      bytes[_classes[byte]] = static_cast<unsigned char>(byte);
+    }
+    return bytes;
+  }
+};
+
+/// An immutable, densely numbered form of a `Machine` produced by
+/// `Machine::compile()`.
+///
+/// States are renumbered into `[0, stateCount())`. Bytes that every state
+/// treats the same share a class, so transitions are kept in a single
+/// row-major `stateCount() x classCount()` table, which for the usual small
+/// alphabets is a handful of columns instead of 256. Index 0 is a reserved
+/// reject state that every missing transition leads to. The final and dead
+/// flags are packed into the high bits of each state id, so a step is a
+/// lookup in the 256 byte classifier and one indexed load, and the flags can
+/// be tested without touching any other table. Rows of dead states loop back
+/// to themselves, which keeps the dead flag sticky.
+///
+/// A compiled machine is a view of its table, which copies share. The table
+/// is either owned, for machines compiled in this process, or lives in a
+/// file mapped by `MachineFile::load`.
+class CompiledMachine {
+public:
+  using state_id = uint32_t;
+
+  static constexpr state_id kFinalFlag = state_id(1) << 31;
+  static constexpr state_id kDeadFlag = state_id(1) << 30;
+  static constexpr state_id kIndexMask = kDeadFlag - 1;
+  static constexpr state_id kRejectState = kDeadFlag;
+  static constexpr size_t kAlphabetSize = 256;
+
+  /// Sizes of the transition table, and what it would take with a column
+  /// per byte.
+  struct Stats {
+    size_t states = 0;
+    size_t classes = 0;
+    size_t tableBytes = 0;
+    size_t unclassifiedTableBytes = 0;
+  };
+
+private:
+  friend Machine;
+  friend MachineFile;
+
+  // Keeps `_classes` and `_table` alive, or null when the caller does.
+  std::shared_ptr<const void> _storage;
+  const uint8_t *_classes;
+  const state_id *_table;
+  size_t _stateCount;
+  size_t _classCount;
+  state_id _startState;
+
+  CompiledMachine(std::shared_ptr<const void> storage, const uint8_t *classes,
+                  const state_id *table, size_t stateCount,
+                  size_t classCount, state_id startState)
+      : _storage(std::move(storage)), _classes(classes), _table(table),
+        _stateCount(stateCount), _classCount(classCount),
+        _startState(startState) {}
+
+  static CompiledMachine own(const ByteClasses &classes,
+                             std::vector<state_id> table,
+                             state_id startState) {
+    struct Storage {
+      std::array<uint8_t, kAlphabetSize> classes;
+      std::vector<state_id> table;
+    };
+    auto storage = std::make_shared<const Storage>(
+        Storage{classes.table(), std::move(table)});
+    const auto stateCount = storage->table.size() / classes.count();
+    return CompiledMachine(storage, storage->classes.data(),
+                           storage->table.data(), stateCount,
+                           classes.count(), startState);
+  }
+
+public:
+  static size_t indexOf(state_id state) noexcept { return state & kIndexMask; }
+  static bool isFinal(state_id state) noexcept { return state & kFinalFlag; }
+  static bool isDead(state_id state) noexcept { return state & kDeadFlag; }
+
+  state_id startState() const noexcept { return _startState; }
+  size_t stateCount() const noexcept { return _stateCount; }
+  size_t classCount() const noexcept { return _classCount; }
+  /// The `stateCount() x classCount()` transition table.
+  const state_id *table() const noexcept { return _table; }
+  /// The class of every byte.
+  const uint8_t *classes() const noexcept { return _classes; }
+
+  uint8_t classOf(char ch) const noexcept {
+    return _classes[static_cast<unsigned char>(ch)];
+  }
+
+  state_id next(state_id state, char ch) const noexcept {
+    return _table[indexOf(state) * _classCount + classOf(ch)];
+  }
+
+  Stats getStats() const noexcept {
+    Stats stats;
+    stats.states = _stateCount;
+    stats.classes = _classCount;
+    stats.tableBytes =
+        kAlphabetSize + _stateCount * _classCount * sizeof(state_id);
+    stats.unclassifiedTableBytes =
+        _stateCount * kAlphabetSize * sizeof(state_id);
+    return stats;
+  }
+
+  bool accept(std::string_view str) const noexcept {
+    auto curState = _startState;
+    for (const auto ch : str) {
+      curState = next(curState, ch);
+      if (isDead(curState)) {
+        break;
+      }
+    }
+    return isFinal(curState);
+  }
+};
+
 class Machine {
 public:
   using state_set = std::unordered_set<size_t>;
   using transitions = std::unordered_map<char, size_t>;
 
+  /// Sizes of a machine before and after `minimize()`.
+  struct MinimizationStats {
+    size_t statesBefore = 0;
+    size_t statesAfter = 0;
+    size_t transitionsBefore = 0;
+    size_t transitionsAfter = 0;
+  };
+
 private:
+  friend ParallelBuilder;
+
   state_set _states;
   size_t _startState;
   state_set _deadStates;
@@ -50,13 +223,165 @@ private:
     return _finalStates.count(state);
   }
 
+  // A non final state whose transitions all loop back to itself can never
+  // lead to acceptance, whatever the rest of the input is.
+  bool isSink(size_t state) const noexcept {
+    if (isFinalState(state)) {
+      return false;
+    }
+    const auto it = _nextStates.find(state);
+    if (it == _nextStates.end()) {
+      return true;
+    }
+    for (const auto &[_, toState] : it->second) {
+      if (toState != state) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The reachable part of a machine, densely numbered in breadth first
+  // order and completed with a reject state, as the starting point of
+  // minimization.
+  struct Completion {
+    std::vector<size_t> reachable;
+    // Sorted symbols used by the reachable states.
+    std::vector<char> alphabet;
+    // Row-major `(reject + 1) x alphabet.size()` transition table.
+    std::vector<size_t> delta;
+    // Index of the added reject state, which is also the reachable count.
+    size_t reject;
+  };
+
+  Completion complete() const {
+    Completion completion;
+    auto &reachable = completion.reachable;
+    auto &alphabet = completion.alphabet;
+
+    // Number the reachable states densely and collect the alphabet.
+    reachable.push_back(_startState);
+    std::unordered_map<size_t, size_t> indices{{_startState, 0}};
+    for (size_t i = 0; i < reachable.size(); ++i) {
+      const auto it = _nextStates.find(reachable[i]);
+      if (it == _nextStates.end()) {
+        continue;
+      }
+      for (const auto &[ch, toState] : it->second) {
+        if (indices.emplace(toState, reachable.size()).second) {
+          reachable.push_back(toState);
+        }
+        alphabet.push_back(ch);
+      }
+    }
+    std::sort(alphabet.begin(), alphabet.end());
+    alphabet.erase(std::unique(alphabet.begin(), alphabet.end()),
+                   alphabet.end());
+
+    // Complete the machine with the reject state so every state has a
+    // transition on every symbol.
+    const auto sigma = alphabet.size();
+    completion.reject = reachable.size();
+    completion.delta.assign((reachable.size() + 1) * sigma, completion.reject);
+    for (size_t q = 0; q < reachable.size(); ++q) {
+      for (size_t a = 0; a < sigma; ++a) {
+        const auto [toState, found] = next(reachable[q], alphabet[a]);
+        if (found) {
+          completion.delta[q * sigma + a] = indices[toState];
+        }
+      }
+    }
+    return completion;
+  }
+
+  // Builds the machine whose states are the blocks of a partition of the
+  // completed machine into equivalent states. Blocks are numbered breadth
+  // first from the start, which makes the result depend only on the
+  // partition, and the one equivalent to the reject state is left out.
+  Machine quotient(const Completion &completion,
+                   const std::vector<size_t> &blockOf, size_t blockCount,
+                   MinimizationStats *stats) const {
+    const auto &delta = completion.delta;
+    const auto &alphabet = completion.alphabet;
+    const auto sigma = alphabet.size();
+
+    std::vector<size_t> representative(blockCount, SIZE_MAX);
+    for (size_t q = 0; q <= completion.reject; ++q) {
+      if (representative[blockOf[q]] == SIZE_MAX) {
+        representative[blockOf[q]] = q;
+      }
+    }
+
+    const auto rejectBlock = blockOf[completion.reject];
+    std::vector<size_t> order;
+    std::vector<size_t> numbering(blockCount, SIZE_MAX);
+    if (blockOf[0] != rejectBlock) {
+      order.push_back(blockOf[0]);
+      numbering[blockOf[0]] = 0;
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+      const auto q = representative[order[i]];
+      for (size_t a = 0; a < sigma; ++a) {
+        const auto toBlock = blockOf[delta[q * sigma + a]];
+        if (toBlock != rejectBlock && numbering[toBlock] == SIZE_MAX) {
+          numbering[toBlock] = order.size();
+          order.push_back(toBlock);
+        }
+      }
+    }
+
+    state_set states{0};
+    state_set finalStates;
+    for (size_t i = 0; i < order.size(); ++i) {
+      states.insert(i);
+      if (isFinalState(completion.reachable[representative[order[i]]])) {
+        finalStates.insert(i);
+      }
+    }
+    Machine minimal(states, /*startState=*/0, finalStates);
+    for (size_t i = 0; i < order.size(); ++i) {
+      const auto q = representative[order[i]];
+      for (size_t a = 0; a < sigma; ++a) {
+        const auto toBlock = blockOf[delta[q * sigma + a]];
+        if (toBlock != rejectBlock) {
+          minimal.addTransition(i, alphabet[a], numbering[toBlock]);
+        }
+      }
+    }
+
+    if (stats) {
+      stats->statesBefore = stateCount();
+      stats->statesAfter = minimal.stateCount();
+      stats->transitionsBefore = transitionCount();
+      stats->transitionsAfter = minimal.transitionCount();
+    }
+    return minimal;
+  }
+
 public:
   Machine(const state_set &machineStates, size_t startState,
           const state_set &finalStates)
-      : _states(machineStates), _finalStates(finalStates),
-        _startState(startState) {
+      : _states(machineStates), _startState(startState),
+        _finalStates(finalStates) {
 
     assert(machineStates.count(startState) && "Invalid start state");
+
+    // Without transitions every non final state is dead until one is added.
+    for (const auto state : machineStates) {
+      if (isSink(state)) {
+        _deadStates.insert(state);
+      }
+    }
+  }
+
+  size_t stateCount() const noexcept { return _states.size(); }
+
+  size_t transitionCount() const noexcept {
+    size_t count = 0;
+    for (const auto &[_, stateTransitions] : _nextStates) {
+      count += stateTransitions.size();
+    }
+    return count;
   }
 
   bool hasAnyTransition(const size_t state) const noexcept {
@@ -70,24 +395,252 @@ public:
 
     addNext(state, input, toState);
 
-    // If the new added transition is to a different state remove from dead
-    // stats lists.
-    if (_deadStates.count(state) && state != toState) {
-      _deadStates.erase(state);
-    } else if (state == toState && !hasAnyTransition(state)) {
+    // Keep the dead states list in sync, a transition to a different state
+    // may revive a state while a self loop keeps it dead.
+    if (isSink(state)) {
       _deadStates.insert(state);
+    } else {
+      _deadStates.erase(state);
     }
   }
 
+  /// Runs the machine incrementally over input that arrives in chunks split
+  /// at arbitrary positions, without buffering any of it.
+  class Cursor {
+    const Machine *_machine;
+    size_t _state;
+    size_t _consumed = 0;
+    bool _rejected = false;
+
+  public:
+    explicit Cursor(const Machine &machine)
+        : _machine(&machine), _state(machine._startState) {}
+
+    /// Advances over `chunk` and returns whether more input can still change
+    /// the verdict. Once it returns false the rest of the stream can be
+    /// skipped and `finish()` called right away.
+    bool feed(std::string_view chunk) noexcept {
+      if (isDone()) {
+        return false;
+      }
+      for (const auto ch : chunk) {
+        ++_consumed;
+        auto [nextState, found] = _machine->next(_state, ch);
+        if (!found) {
+          _rejected = true;
+          return false;
+        }
+        _state = nextState;
+        if (isDead()) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /// The verdict for all input fed so far.
+    bool finish() const noexcept { return isFinal(); }
+
+    void reset() noexcept {
+      _state = _machine->_startState;
+      _consumed = 0;
+      _rejected = false;
+    }
+
+    size_t state() const noexcept { return _state; }
+    /// Number of bytes consumed, including the one that ended the run early.
+    size_t consumed() const noexcept { return _consumed; }
+
+    bool isRejected() const noexcept { return _rejected; }
+    bool isDead() const noexcept { return _machine->_deadStates.count(_state); }
+    bool isDone() const noexcept { return _rejected || isDead(); }
+    bool isFinal() const noexcept {
+      return !_rejected && _machine->isFinalState(_state);
+    }
+  };
+
+  Cursor cursor() const noexcept { return Cursor(*this); }
+
+  /// Returns a machine accepting the same language with the minimum number
+  /// of states, numbered from 0 in breadth first order from the start state.
+  ///
+  /// States unreachable from the start state are dropped first, then the
+  /// rest are merged with Hopcroft's partition refinement. Missing
+  /// transitions lead to an implicit reject state, and the states found to
+  /// be equivalent to it are dropped as well.
+  Machine minimize(MinimizationStats *stats = nullptr) const {
+    const auto completion = complete();
+    const auto &delta = completion.delta;
+    const auto sigma = completion.alphabet.size();
+    const auto reject = completion.reject;
+    const auto total = completion.reject + 1;
+
+    std::vector<std::vector<size_t>> inverse(total * sigma);
+    for (size_t q = 0; q < total; ++q) {
+      for (size_t a = 0; a < sigma; ++a) {
+        inverse[delta[q * sigma + a] * sigma + a].push_back(q);
+      }
+    }
+
+    // Start from the final and non final blocks.
+    std::vector<std::vector<size_t>> blocks(1);
+    std::vector<size_t> blockOf(total, 0);
+    std::vector<size_t> finals;
+    for (size_t q = 0; q < reject; ++q) {
+      if (isFinalState(completion.reachable[q])) {
+        finals.push_back(q);
+      } else {
+        blocks[0].push_back(q);
+      }
+    }
+    blocks[0].push_back(reject);
+
+    // Refining with either of the two initial blocks is enough.
+    std::vector<std::pair<size_t, size_t>> worklist;
+    auto addBlock = [&](std::vector<size_t> members) {
+      const auto block = blocks.size();
+      for (const auto q : members) {
+        blockOf[q] = block;
+      }
+      blocks.push_back(std::move(members));
+      for (size_t a = 0; a < sigma; ++a) {
+        worklist.emplace_back(block, a);
+      }
+    };
+    if (!finals.empty()) {
+      addBlock(std::move(finals));
+    }
+
+    std::vector<bool> marked(total, false);
+    std::vector<size_t> markedStates;
+    std::vector<size_t> markedCount(total, 0);
+    std::vector<size_t> touched;
+    while (!worklist.empty()) {
+      const auto [splitter, a] = worklist.back();
+      worklist.pop_back();
+
+      // Mark every state with a transition on `a` into the splitter.
+      for (const auto q : blocks[splitter]) {
+        for (const auto p : inverse[q * sigma + a]) {
+          if (!marked[p]) {
+            marked[p] = true;
+            markedStates.push_back(p);
+            if (markedCount[blockOf[p]]++ == 0) {
+              touched.push_back(blockOf[p]);
+            }
+          }
+        }
+      }
+
+      // Split the touched blocks. The larger half keeps the block id and
+      // the smaller one is queued, which is correct whether or not the
+      // original block was already pending.
+      for (const auto block : touched) {
+        if (markedCount[block] < blocks[block].size()) {
+          std::vector<size_t> in, out;
+          for (const auto q : blocks[block]) {
+            (marked[q] ? in : out).push_back(q);
+          }
+          if (in.size() > out.size()) {
+            std::swap(in, out);
+          }
+          blocks[block] = std::move(out);
+          addBlock(std::move(in));
+        }
+        markedCount[block] = 0;
+      }
+      for (const auto q : markedStates) {
+        marked[q] = false;
+      }
+      markedStates.clear();
+      touched.clear();
+    }
+    return quotient(completion, blockOf, blocks.size(), stats);
+  }
+
+  /// Renumbers the states into a contiguous range and builds the dense
+  /// transition table of a `CompiledMachine` that accepts the same language.
+  CompiledMachine compile() const {
+    using state_id = CompiledMachine::state_id;
+    assert(_states.size() < CompiledMachine::kIndexMask &&
+           "Too many states to compile");
+
+    // Sort so the numbering does not depend on hash set iteration order.
+    std::vector<size_t> order(_states.begin(), _states.end());
+    std::sort(order.begin(), order.end());
+
+    std::unordered_map<size_t, state_id> ids;
+    for (size_t i = 0; i < order.size(); ++i) {
+      const auto state = order[i];
+      auto id = static_cast<state_id>(i + 1);
+      if (isFinalState(state)) {
+        id |= CompiledMachine::kFinalFlag;
+      }
+      if (_deadStates.count(state)) {
+        id |= CompiledMachine::kDeadFlag;
+      }
+      ids.emplace(state, id);
+    }
+
+    constexpr auto columns = CompiledMachine::kAlphabetSize;
+    std::vector<state_id> table((order.size() + 1) * columns,
+                                CompiledMachine::kRejectState);
+    for (const auto state : order) {
+      const auto id = ids[state];
+      auto *row = &table[CompiledMachine::indexOf(id) * columns];
+      if (CompiledMachine::isDead(id)) {
+        std::fill(row, row + columns, id);
+        continue;
+      }
+
+      const auto it = _nextStates.find(state);
+      if (it == _nextStates.end()) {
+        continue;
+      }
+      for (const auto &[ch, toState] : it->second) {
+        row[static_cast<unsigned char>(ch)] = ids[toState];
+      }
+    }
+
+    // Keep a column only for each class of bytes that every row agrees on.
+    ByteClasses classes;
+    for (size_t index = 0; index <= order.size(); ++index) {
+      const auto *row = &table[index * columns];
+      classes.refine([row](size_t byte) { return row[byte]; });
+    }
+    const auto representatives = classes.representatives();
+    std::vector<state_id> classified((order.size() + 1) * classes.count());
+    for (size_t index = 0; index <= order.size(); ++index) {
+      for (size_t c = 0; c < classes.count(); ++c) {
+        classified[index * classes.count() + c] =
+            table[index * columns + representatives[c]];
+      }
+    }
+    return CompiledMachine::own(classes, std::move(classified),
+                                ids[_startState]);
+  }
+
   bool accept(std::string_view str) const noexcept {
+    NullProbe probe;
+    return accept(str, probe);
+  }
+
+  /// Accepts like `accept(str)`, reporting every step to `probe`.
+  template <class Probe>
+  bool accept(std::string_view str, Probe &probe) const {
     auto curState = _startState;
+    probe.visit(curState);
     for (const auto ch : str) {
       auto [nextState, found] = next(curState, ch);
       if (!found) {
+        probe.reject(curState);
         return false;
       }
+      probe.transition(curState, nextState);
       curState = nextState;
+      probe.visit(curState);
       if (_deadStates.count(curState)) {
+        probe.deadExit(curState);
         break;
       }
     }
@@ -0,0 +1,290 @@
+//
+//  JitMachine.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef JitMachine_h
+#define JitMachine_h
+
+#include "FSM.h"
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(FSM_DISABLE_JIT)
+#define FSM_HAS_JIT 1
+#include <sys/mman.h>
+#else
+#define FSM_HAS_JIT 0
+#endif
+
+/// A `CompiledMachine` turned into native x86-64 code, for the machines that
+/// run the most.
+///
+/// Every state becomes a block of code that checks for the end of input,
+/// loads the next byte and jumps straight to the block of the next state, so
+/// the current state lives in the instruction pointer instead of in a
+/// register indexing a table. A state with few runs of bytes that go to the
+/// same place compares the byte against the ends of the runs; a state with
+/// many uses a jump table. Missing transitions and dead states jump to a
+/// shared reject exit.
+///
+/// The code goes in memory mapped writable, then made executable and read
+/// only with `mprotect`. Where that isn't available, when the JIT was
+/// disabled, or when mapping fails, `accept` falls back to interpreting the
+/// compiled machine, so the answers never depend on which path ran. Define
+/// `FSM_DISABLE_JIT` to leave the code generator out of the build.
+class JitMachine {
+  using function = int (*)(const unsigned char *begin,
+                           const unsigned char *end);
+
+  CompiledMachine _machine;
+  void *_code = nullptr;
+  size_t _codeSize = 0;
+  function _function = nullptr;
+
+#if FSM_HAS_JIT
+  // Just enough of an x86-64 assembler for the code below, with labels that
+  // are bound once and 32 bit relative references to them.
+  class Assembler {
+    std::vector<uint8_t> _bytes;
+    std::vector<size_t> _labels;
+    std::vector<std::pair<size_t, size_t>> _references;
+
+  public:
+    static constexpr size_t kUnbound = SIZE_MAX;
+
+    explicit Assembler(size_t labelCount) : _labels(labelCount, kUnbound) {}
+
+    size_t size() const noexcept { return _bytes.size(); }
+    const std::vector<uint8_t> &bytes() const noexcept { return _bytes; }
+    size_t offsetOf(size_t label) const noexcept { return _labels[label]; }
+
+    void emit(std::initializer_list<uint8_t> bytes) {
+      _bytes.insert(_bytes.end(), bytes);
+    }
+
+    void emit32(uint32_t value) {
+      for (int shift = 0; shift < 32; shift += 8) {
+        _bytes.push_back(static_cast<uint8_t>(value >> shift));
+      }
+    }
+
+    void bind(size_t label) { _labels[label] = _bytes.size(); }
+
+    // A 32 bit offset to `label` from the end of the offset, which is where
+    // the instructions used here take it from.
+    void reference(size_t label) {
+      _references.push_back({_bytes.size(), label});
+      emit32(0);
+    }
+
+    void align(size_t alignment) {
+      while (_bytes.size() % alignment) {
+        emit({0xcc}); // int3
+      }
+    }
+
+    void resolve() {
+      for (const auto &[at, label] : _references) {
+        const auto offset =
+            static_cast<int32_t>(int64_t(_labels[label]) - int64_t(at + 4));
+        std::memcpy(&_bytes[at], &offset, sizeof(offset));
+      }
+    }
+  };
+
+  // States with at most this many runs of bytes compare against the ends of
+  // the runs; beyond that, a jump table is shorter and as fast.
+  static constexpr size_t kMaxCompares = 8;
+
+  // The label of the shared exits, then one per state and one per jump
+  // table.
+  static constexpr size_t kAccept = 0;
+  static constexpr size_t kReject = 1;
+  static constexpr size_t kFirstState = 2;
+
+  static std::vector<uint8_t> generate(const CompiledMachine &machine) {
+    using state_id = CompiledMachine::state_id;
+    constexpr auto bytes = CompiledMachine::kAlphabetSize;
+    const auto count = machine.stateCount();
+    const auto *table = machine.table();
+
+    // The flags of a state are only in the ids that lead to it.
+    std::vector<state_id> ids(count, CompiledMachine::kRejectState);
+    ids[CompiledMachine::indexOf(machine.startState())] =
+        machine.startState();
+    for (size_t i = 0; i < count * machine.classCount(); ++i) {
+      ids[CompiledMachine::indexOf(table[i])] = table[i];
+    }
+
+    // Dead states can't reach a final state, so they reject right away.
+    auto labelOf = [](state_id id) {
+      const auto index = CompiledMachine::indexOf(id);
+      return index == 0 || CompiledMachine::isDead(id) ? kReject
+                                                       : kFirstState + index;
+    };
+
+    const auto firstTable = kFirstState + count;
+    Assembler a(firstTable + count);
+
+    a.emit({0xe9}); // jmp start
+    a.reference(labelOf(machine.startState()));
+    a.bind(kAccept);
+    a.emit({0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3}); // mov eax, 1; ret
+    a.bind(kReject);
+    a.emit({0x31, 0xc0, 0xc3}); // xor eax, eax; ret
+
+    std::vector<size_t> tableStates;
+    for (size_t index = 1; index < count; ++index) {
+      const auto id = ids[index];
+      if (labelOf(id) == kReject) {
+        continue;
+      }
+      a.bind(kFirstState + index);
+      a.emit({0x48, 0x39, 0xf7}); // cmp rdi, rsi
+      a.emit({0x0f, 0x84});       // je exit
+      a.reference(CompiledMachine::isFinal(id) ? kAccept : kReject);
+      a.emit({0x0f, 0xb6, 0x07}); // movzx eax, byte [rdi]
+      a.emit({0x48, 0xff, 0xc7}); // inc rdi
+
+      // Runs of consecutive bytes that go to the same label, by last byte.
+      // Classes are undone here, since the code branches on bytes.
+      std::vector<std::pair<uint32_t, size_t>> runs;
+      for (uint32_t byte = 0; byte < bytes; ++byte) {
+        const auto label = labelOf(machine.next(id, static_cast<char>(byte)));
+        if (!runs.empty() && runs.back().second == label) {
+          runs.back().first = byte;
+        } else {
+          runs.push_back({byte, label});
+        }
+      }
+
+      if (runs.size() <= kMaxCompares) {
+        // Earlier runs were already ruled out, so the last byte of a run is
+        // enough to tell whether the byte is in it.
+        for (size_t r = 0; r + 1 < runs.size(); ++r) {
+          a.emit({0x3d}); // cmp eax, last
+          a.emit32(runs[r].first);
+          a.emit({0x0f, 0x86}); // jbe run
+          a.reference(runs[r].second);
+        }
+        a.emit({0xe9}); // jmp last run
+        a.reference(runs.back().second);
+        continue;
+      }
+
+      a.emit({0x48, 0x8d, 0x0d}); // lea rcx, [rip + table]
+      a.reference(firstTable + tableStates.size());
+      a.emit({0x48, 0x63, 0x14, 0x81}); // movsxd rdx, dword [rcx + rax * 4]
+      a.emit({0x48, 0x01, 0xca});       // add rdx, rcx
+      a.emit({0xff, 0xe2});             // jmp rdx
+      tableStates.push_back(index);
+    }
+
+    // Jump tables hold offsets from their own start, which keeps the code
+    // position independent.
+    for (size_t t = 0; t < tableStates.size(); ++t) {
+      a.align(4);
+      a.bind(firstTable + t);
+      const auto start = a.size();
+      const auto id = ids[tableStates[t]];
+      for (size_t byte = 0; byte < bytes; ++byte) {
+        const auto target =
+            a.offsetOf(labelOf(machine.next(id, static_cast<char>(byte))));
+        a.emit32(static_cast<uint32_t>(target - start));
+      }
+    }
+    a.resolve();
+    return a.bytes();
+  }
+
+  void load(const std::vector<uint8_t> &code) {
+    auto *memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      return;
+    }
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+      munmap(memory, code.size());
+      return;
+    }
+    _code = memory;
+    _codeSize = code.size();
+    _function = reinterpret_cast<function>(memory);
+  }
+#endif
+
+  void release() noexcept {
+#if FSM_HAS_JIT
+    if (_code) {
+      munmap(_code, _codeSize);
+    }
+#endif
+    _code = nullptr;
+    _codeSize = 0;
+    _function = nullptr;
+  }
+
+public:
+  /// Generates native code for `machine` when `enableJit` is set and the
+  /// platform supports it, and interprets it otherwise.
+  explicit JitMachine(CompiledMachine machine, bool enableJit = true)
+      : _machine(std::move(machine)) {
+#if FSM_HAS_JIT
+    if (enableJit) {
+      load(generate(_machine));
+    }
+#else
+    (void)enableJit;
+#endif
+  }
+
+  JitMachine(const JitMachine &) = delete;
+  JitMachine &operator=(const JitMachine &) = delete;
+
+  JitMachine(JitMachine &&other) noexcept
+      : _machine(std::move(other._machine)), _code(other._code),
+        _codeSize(other._codeSize), _function(other._function) {
+    other._code = nullptr;
+    other._codeSize = 0;
+    other._function = nullptr;
+  }
+
+  JitMachine &operator=(JitMachine &&other) noexcept {
+    if (this != &other) {
+      release();
+      _machine = std::move(other._machine);
+      std::swap(_code, other._code);
+      std::swap(_codeSize, other._codeSize);
+      std::swap(_function, other._function);
+    }
+    return *this;
+  }
+
+  ~JitMachine() { release(); }
+
+  /// Whether `accept` runs native code rather than the interpreter.
+  bool isNative() const noexcept { return _function != nullptr; }
+
+  /// Bytes of native code, including jump tables, or 0 when interpreting.
+  size_t codeSize() const noexcept { return _codeSize; }
+
+  const CompiledMachine &machine() const noexcept { return _machine; }
+
+  bool accept(std::string_view str) const noexcept {
+    if (_function) {
+      const auto *begin = reinterpret_cast<const unsigned char *>(str.data());
+      return _function(begin, begin + str.size());
+    }
+    return _machine.accept(str);
+  }
+};
+
+#endif /* JitMachine_h */
@@ -0,0 +1,332 @@
+//
+//  MachineFile.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef MachineFile_h
+#define MachineFile_h
+
+#include "FSM.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FSM_HAS_MMAP 1
+#else
+#define FSM_HAS_MMAP 0
+#endif
+
+/// Reads and writes `CompiledMachine`s in a binary format laid out exactly as
+/// a compiled machine uses it in memory, so a loaded machine matches straight
+/// from the file's pages without parsing or copying anything, and processes
+/// that load the same file share one copy of it in the page cache.
+///
+/// A file is a 64 byte `Header`, the 256 byte classifier at `classesOffset`
+/// and the transition table at `tableOffset`, which keeps it aligned however
+/// the file is mapped. Numbers are in the byte order of the machine that
+/// wrote them, which the header tags: a file from a machine of the other
+/// byte order is refused rather than converted, since converting means
+/// copying. The header carries a format version and a checksum of the
+/// classifier and the table. Loading also checks that every byte has a
+/// class, that every transition leads to a state of the table, and that the
+/// reject row and the rows of dead states are laid out as `compile` lays
+/// them out, so a damaged file is rejected instead of read out of bounds or
+/// matched wrongly.
+class MachineFile {
+public:
+  /// Version 2 added byte classes.
+  static constexpr uint16_t kVersion = 2;
+  static constexpr uint32_t kEndianTag = 0x01020304;
+
+  struct Header {
+    char magic[8];
+    uint32_t endianTag;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t startState;
+    uint32_t classCount;
+    uint64_t stateCount;
+    uint64_t classesOffset;
+    uint64_t tableOffset;
+    uint64_t tableSize;
+    uint64_t checksum;
+  };
+  static_assert(sizeof(Header) == 64,
+                "The header layout is part of the format");
+
+  enum class Error {
+    None,
+    CannotOpen,
+    TooSmall,
+    Misaligned,
+    BadMagic,
+    OtherEndianness,
+    UnsupportedVersion,
+    Truncated,
+    BadChecksum,
+    BadState,
+  };
+
+private:
+  using state_id = CompiledMachine::state_id;
+
+  static constexpr char kMagic[8] = {'F', 'S', 'M', 'T', 'A', 'B', 'L', 'E'};
+
+  static bool fail(Error *error, Error reason) {
+    if (error) {
+      *error = reason;
+    }
+    return false;
+  }
+
+  static bool validate(const void *data, size_t size, Error *error) {
+    if (size < sizeof(Header)) {
+      return fail(error, Error::TooSmall);
+    }
+    if (reinterpret_cast<uintptr_t>(data) % alignof(Header)) {
+      return fail(error, Error::Misaligned);
+    }
+    const auto &header = *static_cast<const Header *>(data);
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+      return fail(error, Error::BadMagic);
+    }
+    if (header.endianTag != kEndianTag) {
+      return fail(error, header.endianTag == __builtin_bswap32(kEndianTag)
+                             ? Error::OtherEndianness
+                             : Error::BadMagic);
+    }
+    if (header.version != kVersion || header.headerSize != sizeof(Header)) {
+      return fail(error, Error::UnsupportedVersion);
+    }
+
+    constexpr auto classesSize = CompiledMachine::kAlphabetSize;
+    if (header.stateCount == 0 ||
+        header.stateCount > CompiledMachine::kIndexMask ||
+        header.classCount == 0 || header.classCount > classesSize ||
+        header.tableSize !=
+            header.stateCount * header.classCount * sizeof(state_id) ||
+        header.classesOffset < sizeof(Header) ||
+        header.tableOffset < sizeof(Header) ||
+        header.tableOffset % alignof(state_id)) {
+      return fail(error, Error::BadState);
+    }
+    if (header.classesOffset > size ||
+        classesSize > size - header.classesOffset ||
+        header.tableOffset > size ||
+        header.tableSize > size - header.tableOffset) {
+      return fail(error, Error::Truncated);
+    }
+
+    const auto *bytes = static_cast<const char *>(data);
+    const auto *classes =
+        reinterpret_cast<const uint8_t *>(bytes + header.classesOffset);
+    const auto *table =
+        reinterpret_cast<const state_id *>(bytes + header.tableOffset);
+    const auto entries = header.tableSize / sizeof(state_id);
+    if (checksum(classes, table, entries) != header.checksum) {
+      return fail(error, Error::BadChecksum);
+    }
+    if (CompiledMachine::indexOf(header.startState) >= header.stateCount) {
+      return fail(error, Error::BadState);
+    }
+    for (size_t byte = 0; byte < classesSize; ++byte) {
+      if (classes[byte] >= header.classCount) {
+        return fail(error, Error::BadState);
+      }
+    }
+    for (size_t i = 0; i < entries; ++i) {
+      if (CompiledMachine::indexOf(table[i]) >= header.stateCount) {
+        return fail(error, Error::BadState);
+      }
+    }
+
+    // `accept` stops at a dead state and answers with its flags, and index
+    // 0 stands for every missing transition, so row 0 has to reject every
+    // byte and a state reached with the dead flag has to loop to itself,
+    // flags included, on every byte.
+    const auto columns = header.classCount;
+    auto loops = [&](state_id id) {
+      const auto *row = table + CompiledMachine::indexOf(id) * columns;
+      return std::all_of(row, row + columns,
+                         [id](state_id target) { return target == id; });
+    };
+    if (!loops(CompiledMachine::kRejectState)) {
+      return fail(error, Error::BadState);
+    }
+    // The dead id each row was checked for, or 0.
+    std::vector<state_id> checked(header.stateCount, 0);
+    for (size_t i = 0; i <= entries; ++i) {
+      const auto id = i < entries ? table[i] : header.startState;
+      const auto index = CompiledMachine::indexOf(id);
+      if (index == 0 && id != CompiledMachine::kRejectState) {
+        return fail(error, Error::BadState);
+      }
+      if (!CompiledMachine::isDead(id) || checked[index] == id) {
+        continue;
+      }
+      if (checked[index] != 0 || !loops(id)) {
+        return fail(error, Error::BadState);
+      }
+      checked[index] = id;
+    }
+    if (error) {
+      *error = Error::None;
+    }
+    return true;
+  }
+
+  static CompiledMachine makeView(std::shared_ptr<const void> storage,
+                                  const void *data) {
+    const auto &header = *static_cast<const Header *>(data);
+    const auto *bytes = static_cast<const char *>(data);
+    return CompiledMachine(
+        std::move(storage),
+        reinterpret_cast<const uint8_t *>(bytes + header.classesOffset),
+        reinterpret_cast<const state_id *>(bytes + header.tableOffset),
+        header.stateCount, header.classCount, header.startState);
+  }
+
+#if FSM_HAS_MMAP
+  // Unmaps the file when the last machine viewing it goes away.
+  struct Mapping {
+    void *data;
+    size_t size;
+
+    Mapping(void *data, size_t size) : data(data), size(size) {}
+    Mapping(const Mapping &) = delete;
+    Mapping &operator=(const Mapping &) = delete;
+    ~Mapping() { munmap(data, size); }
+  };
+#endif
+
+public:
+  /// The checksum a header carries: FNV-1a over the classifier's bytes, then
+  /// over the table's `count` entries rather than its bytes, which is four
+  /// times fewer steps for the same spread.
+  static uint64_t checksum(const uint8_t *classes, const state_id *table,
+                           size_t count) noexcept {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t byte = 0; byte < CompiledMachine::kAlphabetSize; ++byte) {
+      hash = (hash ^ classes[byte]) * 0x100000001b3;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      hash = (hash ^ table[i]) * 0x100000001b3;
+    }
+    return hash;
+  }
+
+  /// The bytes of the file for `machine`.
+  static std::vector<char> serialize(const CompiledMachine &machine) {
+    constexpr auto classesSize = CompiledMachine::kAlphabetSize;
+    const auto tableSize =
+        machine.stateCount() * machine.classCount() * sizeof(state_id);
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.endianTag = kEndianTag;
+    header.version = kVersion;
+    header.headerSize = sizeof(Header);
+    header.startState = machine.startState();
+    header.classCount = static_cast<uint32_t>(machine.classCount());
+    header.stateCount = machine.stateCount();
+    header.classesOffset = sizeof(Header);
+    header.tableOffset = header.classesOffset + classesSize;
+    header.tableSize = tableSize;
+    header.checksum = checksum(machine.classes(), machine.table(),
+                               tableSize / sizeof(state_id));
+
+    std::vector<char> bytes(header.tableOffset + tableSize);
+    std::memcpy(bytes.data(), &header, sizeof(Header));
+    std::memcpy(bytes.data() + header.classesOffset, machine.classes(),
+                classesSize);
+    std::memcpy(bytes.data() + header.tableOffset, machine.table(),
+                tableSize);
+    return bytes;
+  }
+
+  static bool write(const CompiledMachine &machine, const std::string &path) {
+    const auto bytes = serialize(machine);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+    return bool(out.flush());
+  }
+
+  /// A machine that matches straight from the file's bytes in `data`, which
+  /// must stay alive and unchanged while the machine or any copy of it is
+  /// used. `data` needs the alignment of `Header`, which buffers from `new`
+  /// and mappings have.
+  static std::optional<CompiledMachine>
+  view(const void *data, size_t size, Error *error = nullptr) {
+    if (!validate(data, size, error)) {
+      return std::nullopt;
+    }
+    return makeView(nullptr, data);
+  }
+
+  /// Maps the file at `path` read only and returns a machine that matches
+  /// straight from the mapping, which stays until the machine and all its
+  /// copies are gone. Without `mmap`, the file is read into memory instead.
+  static std::optional<CompiledMachine> load(const std::string &path,
+                                             Error *error = nullptr) {
+#if FSM_HAS_MMAP
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      fail(error, Error::CannotOpen);
+      return std::nullopt;
+    }
+    struct stat info {};
+    if (fstat(fd, &info) != 0) {
+      close(fd);
+      fail(error, Error::CannotOpen);
+      return std::nullopt;
+    }
+    const auto size = static_cast<size_t>(info.st_size);
+    if (size < sizeof(Header)) {
+      close(fd);
+      fail(error, Error::TooSmall);
+      return std::nullopt;
+    }
+    auto *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      fail(error, Error::CannotOpen);
+      return std::nullopt;
+    }
+    auto mapping = std::make_shared<const Mapping>(data, size);
+    if (!validate(data, size, error)) {
+      return std::nullopt;
+    }
+    return makeView(std::move(mapping), data);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      fail(error, Error::CannotOpen);
+      return std::nullopt;
+    }
+    const std::vector<char> bytes(std::istreambuf_iterator<char>(in), {});
+    // Words keep the copy aligned for the header and the table.
+    auto storage = std::make_shared<std::vector<uint64_t>>(
+        (bytes.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    std::memcpy(storage->data(), bytes.data(), bytes.size());
+    if (!validate(storage->data(), bytes.size(), error)) {
+      return std::nullopt;
+    }
+    const void *data = storage->data();
+    return makeView(std::move(storage), data);
+#endif
+  }
+};
+
+#endif /* MachineFile_h */
@@ -0,0 +1,209 @@
+//
+//  MultiStream.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef MultiStream_h
+#define MultiStream_h
+
+#include "BatchMatcher.h"
+#include "FSM.h"
+#include <algorithm>
+#include <climits>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/// Advances many independent inputs through one `CompiledMachine` in
+/// lockstep.
+///
+/// A single run is a serial chain of dependent table loads, so the core sits
+/// idle waiting on each one. Interleaving `kLanes` unrelated inputs gives it
+/// that many independent loads to overlap. When a lane runs out of input or
+/// reaches a dead state its verdict is written and the next input takes its
+/// place.
+class InterleavedMatcher {
+public:
+  using state_id = CompiledMachine::state_id;
+
+  static constexpr size_t kLanes = 16;
+
+  enum class Kernel {
+    /// Plain interleaved loads, available everywhere. Lanes are refilled as
+    /// soon as they finish.
+    Scalar,
+    /// AVX2 gathers of 8 table entries at a time. Only pays off on cores
+    /// with fast gathers, so it has to be asked for explicitly.
+    Gather,
+  };
+
+private:
+  // Gather rounds are cut at this many steps so lanes that died early get
+  // replaced reasonably soon.
+  static constexpr size_t kMaxRoundSteps = 256;
+
+  // Lanes with no record left are parked here, in the reject state.
+  static constexpr size_t kIdle = SIZE_MAX;
+  static const unsigned char *idleInput() noexcept {
+    static const unsigned char input[kMaxRoundSteps + 1] = {};
+    return input;
+  }
+
+  struct Lanes {
+    state_id states[kLanes];
+    const unsigned char *inputs[kLanes];
+    const unsigned char *ends[kLanes];
+    size_t records[kLanes];
+  };
+
+#if defined(__AVX2__)
+  static void runGather(const CompiledMachine &machine, Lanes &lanes,
+                        size_t steps) noexcept {
+    static_assert(kLanes == 16, "Kernel is unrolled for two vectors");
+    const auto *table = reinterpret_cast<const int *>(machine.table());
+    const auto *classes = machine.classes();
+    const auto mask = _mm256_set1_epi32(CompiledMachine::kIndexMask);
+    const auto columns = _mm256_set1_epi32(int(machine.classCount()));
+    auto lo = _mm256_loadu_si256(reinterpret_cast<__m256i *>(lanes.states));
+    auto hi =
+        _mm256_loadu_si256(reinterpret_cast<__m256i *>(lanes.states + 8));
+
+    for (size_t step = 0; step < steps; ++step) {
+      alignas(32) int classIds[kLanes];
+      for (size_t l = 0; l < kLanes; ++l) {
+        classIds[l] = classes[*lanes.inputs[l]++];
+      }
+      const auto loClasses =
+          _mm256_load_si256(reinterpret_cast<const __m256i *>(classIds));
+      const auto hiClasses =
+          _mm256_load_si256(reinterpret_cast<const __m256i *>(classIds + 8));
+      const auto loIndex = _mm256_add_epi32(
+          _mm256_mullo_epi32(_mm256_and_si256(lo, mask), columns), loClasses);
+      const auto hiIndex = _mm256_add_epi32(
+          _mm256_mullo_epi32(_mm256_and_si256(hi, mask), columns), hiClasses);
+      lo = _mm256_i32gather_epi32(table, loIndex, 4);
+      hi = _mm256_i32gather_epi32(table, hiIndex, 4);
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes.states), lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes.states + 8), hi);
+  }
+#endif
+
+public:
+  /// Whether the gather kernel was compiled in and the table is small
+  /// enough for its 32 bit indices.
+  static bool canGather(const CompiledMachine &machine) noexcept {
+#if defined(__AVX2__)
+    return machine.stateCount() <= INT_MAX / machine.classCount();
+#else
+    (void)machine;
+    return false;
+#endif
+  }
+
+  /// Sets bit `i` of `results` to whether `inputs[i]` is accepted.
+  static void acceptAll(const CompiledMachine &machine,
+                        const std::string_view *inputs, size_t count,
+                        ResultBitmap &results, Kernel kernel = Kernel::Scalar) {
+    assert((kernel == Kernel::Scalar || canGather(machine)) &&
+           "Gather kernel not available");
+    results.resize(count);
+
+    Lanes lanes;
+    size_t nextRecord = 0;
+    size_t active = 0;
+
+    // Puts the next non empty record in lane `l`, or parks it when there is
+    // none left. Empty records are decided right away.
+    auto refill = [&](size_t l) {
+      while (nextRecord < count && inputs[nextRecord].empty()) {
+        results.set(nextRecord++,
+                    CompiledMachine::isFinal(machine.startState()));
+      }
+      if (nextRecord == count) {
+        lanes.states[l] = CompiledMachine::kRejectState;
+        lanes.inputs[l] = idleInput();
+        lanes.ends[l] = idleInput() + 1;
+        lanes.records[l] = kIdle;
+        return;
+      }
+      const auto input = inputs[nextRecord];
+      lanes.states[l] = machine.startState();
+      lanes.inputs[l] = reinterpret_cast<const unsigned char *>(input.data());
+      lanes.ends[l] = lanes.inputs[l] + input.size();
+      lanes.records[l] = nextRecord++;
+      ++active;
+    };
+
+    // Dead states loop back to themselves, so stopping a lane at any point
+    // after it died gives the same verdict as stopping right away.
+    auto retire = [&](size_t l) {
+      if (lanes.records[l] == kIdle) {
+        lanes.inputs[l] = idleInput();
+        return;
+      }
+      results.set(lanes.records[l], CompiledMachine::isFinal(lanes.states[l]));
+      --active;
+      refill(l);
+    };
+
+    for (size_t l = 0; l < kLanes; ++l) {
+      refill(l);
+    }
+
+#if defined(__AVX2__)
+    if (kernel == Kernel::Gather) {
+      // Gathers step all lanes at once, so they run in rounds as long as the
+      // shortest remaining input.
+      while (active > 0) {
+        auto steps = kMaxRoundSteps;
+        for (size_t l = 0; l < kLanes; ++l) {
+          if (lanes.records[l] != kIdle) {
+            steps = std::min<size_t>(steps, lanes.ends[l] - lanes.inputs[l]);
+          }
+        }
+        runGather(machine, lanes, steps);
+        for (size_t l = 0; l < kLanes; ++l) {
+          if (lanes.records[l] == kIdle || lanes.inputs[l] == lanes.ends[l] ||
+              CompiledMachine::isDead(lanes.states[l])) {
+            retire(l);
+          }
+        }
+      }
+      return;
+    }
+#endif
+
+    // Lanes are retired and refilled as soon as they finish, so inputs of
+    // mixed lengths keep every lane busy.
+    const auto *table = machine.table();
+    const auto *classes = machine.classes();
+    const auto columns = machine.classCount();
+    while (active > 0) {
+      for (size_t l = 0; l < kLanes; ++l) {
+        const auto index = CompiledMachine::indexOf(lanes.states[l]);
+        const auto *input = lanes.inputs[l];
+        const auto state = table[index * columns + classes[*input]];
+        lanes.states[l] = state;
+        lanes.inputs[l] = input + 1;
+        if (input + 1 == lanes.ends[l] || CompiledMachine::isDead(state)) {
+          retire(l);
+        }
+      }
+    }
+  }
+
+  static ResultBitmap acceptAll(const CompiledMachine &machine,
+                                const std::vector<std::string_view> &inputs) {
+    ResultBitmap results;
+    acceptAll(machine, inputs.data(), inputs.size(), results);
+    return results;
+  }
+};
+
+#endif /* MultiStream_h */
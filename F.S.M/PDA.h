@@ -8,9 +8,15 @@
 #ifndef PDA_h
 #define PDA_h
 
+#include "Probe.h"
 #include <cassert>
+#include <cstdint>
+#include <limits>
+#include <optional>
 #include <set>
-#include <stack>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -27,6 +33,7 @@ protected:
 
 public:
   State(int id) : _id(id) {}
+  inline int getId() const noexcept { return _id; }
   bool operator==(const State &rhs) const { return _id == rhs._id; }
 };
 
@@ -50,6 +57,7 @@ public:
 
   inline bool is(char ch) const noexcept { return _ch == ch; }
   inline bool isEpsilon() const noexcept { return _ch == '\0'; }
+  inline char getValue() const noexcept { return _ch; }
 
   bool operator==(const Symbol &rhs) const { return _ch == rhs._ch; }
   bool operator!=(const Symbol &rhs) const { return _ch != rhs._ch; }
@@ -105,6 +113,197 @@ public:
   }
 };
 
+class Automaton;
+
+/// Bounds on a single run.
+struct Limits {
+  /// Deepest the stack may get. Transitions that would push past it are not
+  /// taken, so inputs that need a deeper stack are rejected.
+  size_t maxStackDepth = std::numeric_limits<size_t>::max();
+};
+
+/// An `Automaton` known to be deterministic with one symbol of lookahead,
+/// produced by `Automaton::compileDeterministic()`.
+///
+/// For every state and next input byte, or the end of input, at most one
+/// transition can lead to acceptance for any top of stack. Acceptance is then
+/// a single loop that never backtracks, over a stack kept in a contiguous
+/// vector.
+class DeterministicAutomaton {
+public:
+  /// Lookahead used once the whole input has been read.
+  static constexpr size_t kEndOfInput = 256;
+  static constexpr size_t kLookaheads = kEndOfInput + 1;
+
+private:
+  friend Automaton;
+
+  struct Move {
+    Symbol top;
+    Symbol push;
+    bool consumes;
+    size_t toState;
+  };
+
+  size_t _start;
+  std::vector<bool> _accepting;
+  // The id of each state, for probes.
+  std::vector<int> _ids;
+  // Moves that can be taken from `state` with lookahead `l` are
+  // `_moves[_offsets[state * kLookaheads + l]]` up to the next offset.
+  std::vector<size_t> _offsets;
+  std::vector<Move> _moves;
+
+  DeterministicAutomaton(size_t start, std::vector<bool> accepting,
+                         std::vector<int> ids, std::vector<size_t> offsets,
+                         std::vector<Move> moves)
+      : _start(start), _accepting(std::move(accepting)), _ids(std::move(ids)),
+        _offsets(std::move(offsets)), _moves(std::move(moves)) {}
+
+  // Takes moves for `lookahead` until one reads it or, at the end of input,
+  // until an accepting state is reached. Returns false when there is no move
+  // left, which can only happen on inputs that aren't accepted, or when the
+  // stack would grow past the limit.
+  template <class Probe>
+  bool advance(size_t &state, std::vector<Symbol> &stack, size_t lookahead,
+               const Limits &limits, Probe &probe) const {
+    while (true) {
+      if (lookahead == kEndOfInput && _accepting[state]) {
+        return true;
+      }
+
+      const auto row = state * kLookaheads + lookahead;
+      const Move *move = nullptr;
+      for (auto m = _offsets[row]; m < _offsets[row + 1]; ++m) {
+        const auto top = _moves[m].top;
+        if (top.isEpsilon() || (!stack.empty() && stack.back() == top)) {
+          move = &_moves[m];
+          break;
+        }
+      }
+      if (!move) {
+        probe.reject(_ids[state]);
+        return false;
+      }
+
+      if (!move->top.isEpsilon()) {
+        stack.pop_back();
+      }
+      if (!move->push.isEpsilon()) {
+        if (stack.size() == limits.maxStackDepth) {
+          return false;
+        }
+        stack.push_back(move->push);
+        probe.stackDepth(stack.size());
+      }
+      probe.transition(_ids[state], _ids[move->toState]);
+      state = move->toState;
+      probe.visit(_ids[state]);
+      if (move->consumes) {
+        return true;
+      }
+    }
+  }
+
+public:
+  /// Runs the automaton incrementally over input that arrives in chunks
+  /// split at arbitrary positions, keeping only the current state and stack.
+  ///
+  /// Epsilon moves depend on the byte that follows, so the moves for a chunk's
+  /// last byte are taken when the next chunk or `finish()` arrives.
+  class Session {
+    const DeterministicAutomaton *_automaton;
+    Limits _limits;
+    size_t _state;
+    std::vector<Symbol> _stack;
+    size_t _consumed = 0;
+    bool _rejected = false;
+    bool _finished = false;
+
+  public:
+    explicit Session(const DeterministicAutomaton &automaton,
+                     Limits limits = Limits())
+        : _automaton(&automaton), _limits(limits),
+          _state(automaton._start) {}
+
+    /// Advances over `chunk` and returns false once the input is certain to
+    /// be rejected, after which the rest of the stream can be skipped.
+    bool feed(std::string_view chunk) {
+      assert(!_finished && "Feeding a finished session");
+      if (_rejected) {
+        return false;
+      }
+      NullProbe probe;
+      for (const auto ch : chunk) {
+        if (!_automaton->advance(_state, _stack,
+                                 static_cast<unsigned char>(ch), _limits,
+                                 probe)) {
+          _rejected = true;
+          return false;
+        }
+        ++_consumed;
+      }
+      return true;
+    }
+
+    /// The verdict for all input fed so far, which ends the input.
+    bool finish() {
+      if (!_finished && !_rejected) {
+        NullProbe probe;
+        _rejected =
+            !_automaton->advance(_state, _stack, kEndOfInput, _limits, probe);
+      }
+      _finished = true;
+      return !_rejected;
+    }
+
+    void reset() {
+      _state = _automaton->_start;
+      _stack.clear();
+      _consumed = 0;
+      _rejected = false;
+      _finished = false;
+    }
+
+    /// Number of bytes read without rejecting.
+    size_t consumed() const noexcept { return _consumed; }
+    size_t stackDepth() const noexcept { return _stack.size(); }
+    bool isRejected() const noexcept { return _rejected; }
+
+    /// Offset of the byte at which the input became certain to be rejected,
+    /// or the input length when only its end was, e.g. with unclosed
+    /// brackets.
+    std::optional<size_t> rejectionOffset() const noexcept {
+      return _rejected ? std::optional<size_t>(_consumed) : std::nullopt;
+    }
+  };
+
+  Session session(Limits limits = Limits()) const {
+    return Session(*this, limits);
+  }
+
+  bool accept(std::string_view input, Limits limits = Limits()) const {
+    auto session = Session(*this, limits);
+    return session.feed(input) && session.finish();
+  }
+
+  /// Same as `accept(input, limits)`, reporting every move to `probe`.
+  template <class Probe>
+  bool accept(std::string_view input, Probe &probe,
+              Limits limits = Limits()) const {
+    auto state = _start;
+    std::vector<Symbol> stack;
+    probe.visit(_ids[state]);
+    for (const auto ch : input) {
+      if (!advance(state, stack, static_cast<unsigned char>(ch), limits,
+                   probe)) {
+        return false;
+      }
+    }
+    return advance(state, stack, kEndOfInput, limits, probe);
+  }
+};
+
 class Automaton {
 private:
   State _start;
@@ -131,93 +330,460 @@ public:
     _transitions[fromState].add({input, top, push, toState});
   }
 
-  bool accept(std::string_view input) const {
-    std::stack<Symbol> stack;
-    size_t i = 0;
-    return acceptImpl(input, stack, _start, i);
-  }
+  /// Builds the fast form of this automaton if it is deterministic with one
+  /// symbol of lookahead, or returns `std::nullopt`.
+  ///
+  /// An epsilon transition is only considered for a lookahead its target can
+  /// go on with: a byte some state in the target's epsilon closure reads, or
+  /// the end of input when that closure has an accepting state. The stack is
+  /// ignored here, so this never rules out a transition that could lead to
+  /// acceptance. The automaton is deterministic when no two of the remaining
+  /// transitions of a state and lookahead can apply to the same top of stack,
+  /// which holds for the 0^n 1^n automaton even though its loop state has
+  /// both a read and an epsilon transition. Epsilon cycles are rejected too,
+  /// since a deterministic run would loop on them forever.
+  std::optional<DeterministicAutomaton> compileDeterministic() const {
+    std::unordered_map<State, size_t, state_hash> indices;
+    const auto states = indexStates(indices);
+    const auto count = states.size();
+
+    auto transitionsOf = [&](size_t q) -> const StateTransitions & {
+      return getStateTransitions(states[q]);
+    };
 
-private:
-  static bool canTakeTransition(std::string_view input,
-                                std::stack<Symbol> &stack, size_t i,
-                                Transition symbolTransition) {
-    const auto inputSymbol = symbolTransition.getInput();
-    const auto top = symbolTransition.getTop();
+    // Epsilon closures. A state that is in its own closure is on a cycle.
+    std::vector<std::vector<size_t>> closures(count);
+    for (size_t q = 0; q < count; ++q) {
+      std::vector<bool> inClosure(count, false);
+      std::vector<size_t> stack{q};
+      inClosure[q] = true;
+      while (!stack.empty()) {
+        const auto p = stack.back();
+        stack.pop_back();
+        closures[q].push_back(p);
+        for (const auto &t : transitionsOf(p).getEpsilonTransitions()) {
+          const auto r = indices.at(t.getToState());
+          if (r == q) {
+            return std::nullopt;
+          }
+          if (!inClosure[r]) {
+            inClosure[r] = true;
+            stack.push_back(r);
+          }
+        }
+      }
+    }
 
-    if (!inputSymbol.isEpsilon() && !inputSymbol.is(input[i])) {
-      return false;
+    // Which lookaheads each state can go on with, reading or accepting.
+    std::vector<std::vector<bool>> canContinue(
+        count, std::vector<bool>(DeterministicAutomaton::kLookaheads, false));
+    for (size_t q = 0; q < count; ++q) {
+      for (const auto p : closures[q]) {
+        for (const auto &t : transitionsOf(p).getTransitions()) {
+          canContinue[q][static_cast<unsigned char>(t.getInput().getValue())] =
+              true;
+        }
+        if (isAccepting(states[p])) {
+          canContinue[q][DeterministicAutomaton::kEndOfInput] = true;
+        }
+      }
     }
 
-    if (!top.isEpsilon()) {
-      if (stack.empty())
-        return false;
-      if (top != stack.top())
-        return false;
+    std::vector<bool> accepting(count);
+    std::vector<int> ids(count);
+    std::vector<size_t> offsets{0};
+    std::vector<DeterministicAutomaton::Move> moves;
+    for (size_t q = 0; q < count; ++q) {
+      accepting[q] = isAccepting(states[q]);
+      ids[q] = states[q].getId();
+      const auto &stateTransitions = transitionsOf(q);
+      for (size_t l = 0; l < DeterministicAutomaton::kLookaheads; ++l) {
+        const auto rowBegin = moves.size();
+        auto addMove = [&](const Transition &t, bool consumes) {
+          for (auto m = rowBegin; m < moves.size(); ++m) {
+            const auto top = moves[m].top;
+            if (top.isEpsilon() || t.getTop().isEpsilon() ||
+                top == t.getTop()) {
+              return false;
+            }
+          }
+          moves.push_back({t.getTop(), t.getPush(), consumes,
+                           indices.at(t.getToState())});
+          return true;
+        };
+
+        for (const auto &t : stateTransitions.getTransitions()) {
+          if (static_cast<unsigned char>(t.getInput().getValue()) == l &&
+              !addMove(t, /*consumes=*/true)) {
+            return std::nullopt;
+          }
+        }
+        for (const auto &t : stateTransitions.getEpsilonTransitions()) {
+          if (canContinue[indices.at(t.getToState())][l] &&
+              !addMove(t, /*consumes=*/false)) {
+            return std::nullopt;
+          }
+        }
+        offsets.push_back(moves.size());
+      }
     }
+    return DeterministicAutomaton(indices.at(_start), std::move(accepting),
+                                  std::move(ids), std::move(offsets),
+                                  std::move(moves));
+  }
 
-    return true;
+  /// Accepts when some run reads the whole input and ends in an accepting
+  /// state, whatever is left on the stack.
+  ///
+  /// Runs are explored by reachability over (state, position) nodes instead
+  /// of backtracking, so the time is polynomial in the input length and
+  /// epsilon loops that keep pushing still terminate. A context is the node
+  /// reached right after pushing a symbol, together with that symbol, and
+  /// holds every node reachable from it without popping that symbol. Popping
+  /// it resumes every context that made the push, so what happens above a
+  /// push is worked out once for all the runs that make it. The bottom
+  /// context is the start state with an empty stack.
+  bool accept(std::string_view input) const {
+    NullProbe probe;
+    return accept(input, probe);
   }
 
-  bool acceptImpl(std::string_view input, std::stack<Symbol> &stack,
-                  State currentState, size_t i) const {
-    auto it = _transitions.find(currentState);
-    assert(it != _transitions.end() &&
-           "All states are expected to have transitons even if empty");
-    auto &[a, stateTransitions] = *it;
+  /// Same as `accept(input)`, reporting to `probe` every state processed,
+  /// every transition taken and every time a context is reused.
+  template <class Probe>
+  bool accept(std::string_view input, Probe &probe) const {
+    std::unordered_map<State, size_t, state_hash> indices;
+    const auto states = indexStates(indices);
+
+    // Transitions that pop and push in one step get a node of their own
+    // between the pop and the push, numbered after the states.
+    struct Edge {
+      Transition transition;
+      size_t to;
+      size_t via;
+    };
+    std::vector<std::vector<Edge>> edges(states.size());
+    std::vector<Edge> replacements;
+    for (size_t q = 0; q < states.size(); ++q) {
+      const auto &stateTransitions = getStateTransitions(states[q]);
+      for (const auto *list : {&stateTransitions.getTransitions(),
+                               &stateTransitions.getEpsilonTransitions()}) {
+        for (const auto &t : *list) {
+          const auto to = indices.at(t.getToState());
+          auto via = to;
+          if (!t.getTop().isEpsilon() && !t.getPush().isEpsilon()) {
+            via = states.size() + replacements.size();
+            replacements.push_back({t, to, via});
+          }
+          edges[q].push_back({t, to, via});
+        }
+      }
+    }
+
+    const auto columns = input.size() + 1;
+    auto nodeOf = [columns](size_t q, size_t i) { return q * columns + i; };
 
-    auto attemptTakeTransitions = [this, &stack, &input,
-                                   i](const transition_list &transitions) {
-      for (const auto &symbolTransition : transitions) {
-        if (!canTakeTransition(input, stack, i, symbolTransition)) {
-          continue;
+    struct Context {
+      size_t symbol;
+      std::unordered_set<size_t> reached;
+      std::unordered_set<size_t> callers;
+      // Nodes reached right after popping the context's symbol.
+      std::unordered_set<size_t> exits;
+    };
+    std::vector<Context> contexts;
+    std::unordered_map<size_t, size_t> contextIds;
+    std::vector<std::pair<size_t, size_t>> worklist;
+
+    auto reach = [&](size_t context, size_t node) {
+      if (contexts[context].reached.insert(node).second) {
+        worklist.push_back({context, node});
+      }
+    };
+
+    auto push = [&](size_t caller, size_t entry, Symbol symbol) {
+      const auto key = entry * kStackSymbols +
+                       static_cast<unsigned char>(symbol.getValue());
+      const auto [it, inserted] = contextIds.emplace(key, contexts.size());
+      if (inserted) {
+        contexts.push_back(
+            {static_cast<unsigned char>(symbol.getValue()), {}, {}, {}});
+        reach(it->second, entry);
+      }
+      if (!inserted) {
+        probe.memoHit(states[entry / columns].getId());
+      }
+      auto &context = contexts[it->second];
+      if (context.callers.insert(caller).second) {
+        for (const auto exit : context.exits) {
+          reach(caller, exit);
         }
+      }
+    };
 
-        // Look into the top of stack and pop if not epsilon transition.
-        const auto top = symbolTransition.getTop();
+    auto pop = [&](size_t context, Symbol symbol, size_t exit) {
+      if (contexts[context].symbol !=
+          static_cast<unsigned char>(symbol.getValue())) {
+        return;
+      }
+      if (contexts[context].exits.insert(exit).second) {
+        for (const auto caller : contexts[context].callers) {
+          reach(caller, exit);
+        }
+      }
+    };
+
+    contexts.push_back({kBottom, {}, {}, {}});
+    reach(0, nodeOf(indices.at(_start), 0));
+    while (!worklist.empty()) {
+      const auto [context, node] = worklist.back();
+      worklist.pop_back();
+      const auto q = node / columns;
+      const auto i = node % columns;
+
+      if (q >= states.size()) {
+        const auto &replacement = replacements[q - states.size()];
+        push(context, nodeOf(replacement.to, i),
+             replacement.transition.getPush());
+        continue;
+      }
+      probe.visit(states[q].getId());
+      if (i == input.size() && isAccepting(states[q])) {
+        return true;
+      }
+
+      for (const auto &[t, to, via] : edges[q]) {
+        auto j = i;
+        if (!t.isEpsilonTransition()) {
+          if (i == input.size() || !t.getInput().is(input[i])) {
+            continue;
+          }
+          ++j;
+        }
+        probe.transition(states[q].getId(), states[to].getId());
+
+        const auto top = t.getTop();
+        const auto toPush = t.getPush();
         if (!top.isEpsilon()) {
-          assert(stack.top() == top && "Not the top of stack?");
-          stack.pop();
+          pop(context, top, nodeOf(via, j));
+        } else if (!toPush.isEpsilon()) {
+          push(context, nodeOf(to, j), toPush);
+        } else {
+          reach(context, nodeOf(to, j));
         }
+      }
+    }
+    return false;
+  }
 
-        // Push the new symbol to stack.
-        const auto toPush = symbolTransition.getPush();
-        if (!toPush.isEpsilon()) {
-          stack.push(toPush);
+  /// Accepts like `accept`, searching runs depth first the way a recursive
+  /// backtracking search would, but on an explicit path of frames.
+  ///
+  /// Each frame records the stack edit of the move into it, which is undone
+  /// when the search backs out of the frame, so memory grows with the length
+  /// of the current run and the stack depth rather than with the native call
+  /// stack. A move that would repeat a configuration already on the path,
+  /// the same state, position and stack, is skipped, which cuts epsilon
+  /// cycles that leave the stack as it was. Epsilon cycles that keep pushing
+  /// only end at `limits.maxStackDepth`, and the search can take exponential
+  /// time; `accept` avoids both but can't bound the stack depth.
+  bool acceptIterative(std::string_view input, Limits limits = Limits()) const {
+    NullProbe probe;
+    return acceptIterative(input, probe, limits);
+  }
+
+  /// Same as `acceptIterative(input, limits)`, reporting to `probe` every
+  /// frame entered and backed out of, and the stack depth.
+  template <class Probe>
+  bool acceptIterative(std::string_view input, Probe &probe,
+                       Limits limits = Limits()) const {
+    std::unordered_map<State, size_t, state_hash> indices;
+    const auto states = indexStates(indices);
+    std::vector<std::vector<std::pair<Transition, size_t>>> edges(
+        states.size());
+    for (size_t q = 0; q < states.size(); ++q) {
+      const auto &stateTransitions = getStateTransitions(states[q]);
+      // Reading transitions first, then epsilon ones, as before.
+      for (const auto *list : {&stateTransitions.getTransitions(),
+                               &stateTransitions.getEpsilonTransitions()}) {
+        for (const auto &t : *list) {
+          edges[q].push_back({t, indices.at(t.getToState())});
         }
+      }
+    }
+
+    struct Frame {
+      size_t state;
+      size_t i;
+      size_t nextEdge;
+      // The stack edit of the move into this frame.
+      Symbol popped;
+      Symbol pushed;
+      uint64_t key;
+    };
+
+    std::vector<Symbol> stack;
+    // `hashes[h]` is the hash of the bottom `h` symbols of the stack.
+    std::vector<uint64_t> hashes{0};
+    auto keyOf = [&](size_t state, size_t i) {
+      auto key = hashes.back();
+      for (const auto part : {state, i, stack.size()}) {
+        key = (key ^ part) * 0x100000001b3;
+      }
+      return key;
+    };
+    auto pushSymbol = [&](Symbol symbol) {
+      stack.push_back(symbol);
+      hashes.push_back(
+          (hashes.back() + static_cast<unsigned char>(symbol.getValue()) + 1) *
+          0x9e3779b97f4a7c15);
+    };
+    auto popSymbol = [&]() {
+      stack.pop_back();
+      hashes.pop_back();
+    };
+    auto undo = [&](const Frame &frame) {
+      if (!frame.pushed.isEpsilon()) {
+        popSymbol();
+      }
+      if (!frame.popped.isEpsilon()) {
+        pushSymbol(frame.popped);
+      }
+    };
 
-        // Because of undeterminism we have to attempt all possible transitions
-        // for each state.
-        const auto inputSymbol = symbolTransition.getInput();
-        const auto toState = symbolTransition.getToState();
-        auto nextI = inputSymbol.isEpsilon() ? i : i + 1;
-        if (acceptImpl(input, stack, toState, nextI)) {
+    // Configurations on the path by key. Keys are only hashes, so a match is
+    // confirmed by rebuilding the stack the earlier frame had.
+    std::unordered_multimap<uint64_t, size_t> onPath;
+    std::vector<Frame> path;
+    auto isOnPath = [&](const Frame &next) {
+      const auto [begin, end] = onPath.equal_range(next.key);
+      for (auto it = begin; it != end; ++it) {
+        const auto &earlier = path[it->second];
+        if (earlier.state != next.state || earlier.i != next.i) {
+          continue;
+        }
+        auto rebuilt = stack;
+        auto undoOn = [&rebuilt](const Frame &frame) {
+          if (!frame.pushed.isEpsilon()) {
+            rebuilt.pop_back();
+          }
+          if (!frame.popped.isEpsilon()) {
+            rebuilt.push_back(frame.popped);
+          }
+        };
+        undoOn(next);
+        for (auto f = path.size() - 1; f > it->second; --f) {
+          undoOn(path[f]);
+        }
+        if (rebuilt == stack) {
           return true;
         }
+      }
+      return false;
+    };
 
-        // Restore the stack state if that transition is not accepted.
-        if (!toPush.isEpsilon()) {
-          assert(stack.top() == toPush && "Not the last pushed to stack?");
-          stack.pop();
+    const auto e = Symbol::epsilon();
+    const auto start = indices.at(_start);
+    path.push_back({start, 0, 0, e, e, keyOf(start, 0)});
+    onPath.emplace(path.back().key, 0);
+    probe.visit(states[start].getId());
+    while (!path.empty()) {
+      auto &frame = path.back();
+      if (frame.nextEdge == 0 && frame.i == input.size() &&
+          isAccepting(states[frame.state])) {
+        return true;
+      }
+
+      bool moved = false;
+      while (!moved && frame.nextEdge < edges[frame.state].size()) {
+        const auto &[t, to] = edges[frame.state][frame.nextEdge++];
+        auto j = frame.i;
+        if (!t.isEpsilonTransition()) {
+          if (j == input.size() || !t.getInput().is(input[j])) {
+            continue;
+          }
+          ++j;
+        }
+        const auto top = t.getTop();
+        const auto toPush = t.getPush();
+        if (!top.isEpsilon() && (stack.empty() || stack.back() != top)) {
+          continue;
+        }
+        const auto depth = stack.size() - !top.isEpsilon();
+        if (!toPush.isEpsilon() && depth == limits.maxStackDepth) {
+          continue;
         }
 
+        Frame next{to, j, 0, top, toPush, 0};
         if (!top.isEpsilon()) {
-          stack.push(top);
+          popSymbol();
         }
+        if (!toPush.isEpsilon()) {
+          pushSymbol(toPush);
+        }
+        next.key = keyOf(to, j);
+        if (isOnPath(next)) {
+          undo(next);
+          continue;
+        }
+        probe.transition(states[frame.state].getId(), states[to].getId());
+        probe.visit(states[to].getId());
+        probe.stackDepth(stack.size());
+        onPath.emplace(next.key, path.size());
+        path.push_back(next);
+        moved = true;
+      }
+      if (moved) {
+        continue;
       }
-      return false;
-    };
 
-    if (attemptTakeTransitions(stateTransitions.getTransitions())) {
-      return true;
+      // Every move from this frame failed; back out of it.
+      const auto [begin, end] = onPath.equal_range(frame.key);
+      for (auto it = begin; it != end; ++it) {
+        if (it->second == path.size() - 1) {
+          onPath.erase(it);
+          break;
+        }
+      }
+      probe.backtrack(states[frame.state].getId());
+      undo(frame);
+      path.pop_back();
     }
+    return false;
+  }
 
-    // Attempt epsilon transitions last.
-    if (attemptTakeTransitions(stateTransitions.getEpsilonTransitions())) {
-      return true;
+private:
+  // Stack symbols are bytes; the bottom context uses one more symbol that no
+  // transition can pop.
+  static constexpr size_t kBottom = 256;
+  static constexpr size_t kStackSymbols = kBottom + 1;
+
+  // Numbers the start state, every state with transitions and every state
+  // a transition leads to.
+  std::vector<State>
+  indexStates(std::unordered_map<State, size_t, state_hash> &indices) const {
+    std::vector<State> states;
+    auto addState = [&](State state) {
+      if (indices.emplace(state, states.size()).second) {
+        states.push_back(state);
+      }
+    };
+    addState(_start);
+    for (const auto &[state, stateTransitions] : _transitions) {
+      addState(state);
+      for (const auto &t : stateTransitions.getTransitions()) {
+        addState(t.getToState());
+      }
+      for (const auto &t : stateTransitions.getEpsilonTransitions()) {
+        addState(t.getToState());
+      }
     }
+    return states;
+  }
 
-    // Is only accepted if is in a final state after scanning whole input.
-    return isAccepting(currentState) && i >= input.size();
+  const StateTransitions &getStateTransitions(State state) const {
+    static const StateTransitions noTransitions;
+    const auto it = _transitions.find(state);
+    return it == _transitions.end() ? noTransitions : it->second;
   }
 };
 } // namespace PDA
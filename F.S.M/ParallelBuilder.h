@@ -0,0 +1,226 @@
+//
+//  ParallelBuilder.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef ParallelBuilder_h
+#define ParallelBuilder_h
+
+#include "FSM.h"
+#include "ThreadPool.h"
+#include "regex-matcher.h"
+#include <array>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/// Builds large automata on a `WorkStealingPool`.
+///
+/// Both builders give exactly what their sequential counterparts give, no
+/// matter how many threads the pool has: the work is split up in parallel,
+/// but numbers are only handed out in a sequential pass afterwards, in the
+/// order the sequential algorithm would have found the states in.
+class ParallelBuilder {
+  using key = std::vector<size_t>;
+
+  struct KeyHash {
+    size_t operator()(const key &states) const noexcept {
+      size_t hash = states.size();
+      for (const auto state : states) {
+        hash ^= state + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+      }
+      return hash;
+    }
+  };
+
+  // A hash table that many threads can add keys to at once, split in shards
+  // that are locked separately. Entries keep their address until `clear()`,
+  // so the number of an entry can be filled in after all threads are done.
+  class InternTable {
+    static constexpr size_t kShards = 64;
+
+    struct Shard {
+      std::mutex mutex;
+      std::unordered_map<key, size_t, KeyHash> entries;
+    };
+    std::array<Shard, kShards> _shards;
+
+  public:
+    using entry = std::pair<const key, size_t>;
+    static constexpr size_t kUnnumbered = std::numeric_limits<size_t>::max();
+
+    entry *intern(key states) {
+      const auto hash = KeyHash()(states);
+      // The low bits pick the bucket inside the shard, so use the high ones.
+      auto &shard = _shards[(hash >> 32) % kShards];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      return &*shard.entries.emplace(std::move(states), kUnnumbered).first;
+    }
+
+    void clear() {
+      for (auto &shard : _shards) {
+        shard.entries.clear();
+      }
+    }
+  };
+
+  // Calls `fn(begin, end)` on the pool for consecutive ranges of `count`
+  // items, big enough to be worth a task.
+  template <class Fn>
+  static void forEachRange(WorkStealingPool &pool, size_t count, Fn fn) {
+    constexpr size_t kMinRange = 256;
+    const auto ranges = std::min((count + kMinRange - 1) / kMinRange,
+                                 pool.threadCount() * 4);
+    if (ranges == 0) {
+      return;
+    }
+    const auto perRange = (count + ranges - 1) / ranges;
+    pool.parallelFor(ranges, [&](size_t r) {
+      const auto begin = r * perRange;
+      fn(begin, std::min(count, begin + perRange));
+    });
+  }
+
+public:
+  /// Builds the same machine as `regex::determinize`.
+  ///
+  /// The subset construction goes one breadth first level at a time. The
+  /// successors of every state in the level are computed in parallel and
+  /// looked up in a shared table, then the new ones are numbered walking the
+  /// level in order and bytes from 0 to 255, which is the order a sequential
+  /// breadth first search finds them in.
+  static std::optional<Machine>
+  determinize(const regex::NFA &nfa, WorkStealingPool &pool,
+              size_t maxStates = std::numeric_limits<size_t>::max()) {
+    InternTable table;
+    auto *start = table.intern({nfa.getStartState()});
+    start->second = 0;
+
+    std::vector<const InternTable::entry *> frontier{start};
+    std::vector<const InternTable::entry *> states{start};
+    std::vector<std::vector<std::pair<char, size_t>>> transitions(1);
+    std::vector<std::array<InternTable::entry *, 256>> successors;
+    while (!frontier.empty()) {
+      successors.resize(frontier.size());
+      pool.parallelFor(frontier.size(), [&](size_t k) {
+        for (size_t byte = 0; byte < 256; ++byte) {
+          key next;
+          for (const auto state : frontier[k]->first) {
+            nfa.forEachNext(state, static_cast<char>(byte),
+                            [&](size_t target) { next.push_back(target); });
+          }
+          std::sort(next.begin(), next.end());
+          next.erase(std::unique(next.begin(), next.end()), next.end());
+          successors[k][byte] =
+              next.empty() ? nullptr : table.intern(std::move(next));
+        }
+      });
+
+      std::vector<const InternTable::entry *> nextFrontier;
+      for (size_t k = 0; k < frontier.size(); ++k) {
+        const auto from = frontier[k]->second;
+        for (size_t byte = 0; byte < 256; ++byte) {
+          auto *entry = successors[k][byte];
+          if (!entry) {
+            continue;
+          }
+          if (entry->second == InternTable::kUnnumbered) {
+            if (states.size() == maxStates) {
+              return std::nullopt;
+            }
+            entry->second = states.size();
+            states.push_back(entry);
+            transitions.emplace_back();
+            nextFrontier.push_back(entry);
+          }
+          transitions[from].push_back({static_cast<char>(byte), entry->second});
+        }
+      }
+      frontier = std::move(nextFrontier);
+    }
+
+    Machine::state_set machineStates;
+    Machine::state_set finalStates;
+    for (size_t i = 0; i < states.size(); ++i) {
+      machineStates.insert(i);
+      for (const auto state : states[i]->first) {
+        if (nfa.isFinalState(state)) {
+          finalStates.insert(i);
+          break;
+        }
+      }
+    }
+    Machine machine(machineStates, /*startState=*/0, finalStates);
+    for (size_t i = 0; i < transitions.size(); ++i) {
+      for (const auto &[ch, target] : transitions[i]) {
+        machine.addTransition(i, ch, target);
+      }
+    }
+    return machine;
+  }
+
+  /// Builds the same machine as `Machine::minimize`.
+  ///
+  /// Uses Moore's partition refinement instead of Hopcroft's, since every
+  /// round of it is independent work per state: a state's signature is its
+  /// block and the blocks of its successors. Signatures are interned in
+  /// parallel, and blocks are renumbered in state order afterwards until a
+  /// round no longer splits any block.
+  static Machine minimize(const Machine &machine, WorkStealingPool &pool,
+                          Machine::MinimizationStats *stats = nullptr) {
+    const auto completion = machine.complete();
+    const auto &delta = completion.delta;
+    const auto sigma = completion.alphabet.size();
+    const auto total = completion.reject + 1;
+
+    std::vector<size_t> blockOf(total, 0);
+    bool hasFinal = false;
+    for (size_t q = 0; q < completion.reject; ++q) {
+      if (machine.isFinalState(completion.reachable[q])) {
+        blockOf[q] = 1;
+        hasFinal = true;
+      }
+    }
+    size_t blockCount = hasFinal ? 2 : 1;
+
+    InternTable table;
+    std::vector<InternTable::entry *> signatures(total);
+    while (true) {
+      forEachRange(pool, total, [&](size_t begin, size_t end) {
+        for (auto q = begin; q < end; ++q) {
+          key signature(sigma + 1);
+          signature[0] = blockOf[q];
+          for (size_t a = 0; a < sigma; ++a) {
+            signature[a + 1] = blockOf[delta[q * sigma + a]];
+          }
+          signatures[q] = table.intern(std::move(signature));
+        }
+      });
+
+      size_t refinedCount = 0;
+      for (size_t q = 0; q < total; ++q) {
+        auto &number = signatures[q]->second;
+        if (number == InternTable::kUnnumbered) {
+          number = refinedCount++;
+        }
+        blockOf[q] = number;
+      }
+      table.clear();
+
+      // Refinement only ever splits blocks, so an unchanged count means an
+      // unchanged partition.
+      if (refinedCount == blockCount) {
+        break;
+      }
+      blockCount = refinedCount;
+    }
+    return machine.quotient(completion, blockOf, blockCount, stats);
+  }
+};
+
+#endif /* ParallelBuilder_h */
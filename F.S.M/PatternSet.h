@@ -0,0 +1,265 @@
+//
+//  PatternSet.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef PatternSet_h
+#define PatternSet_h
+
+#include "BatchMatcher.h"
+#include "FSM.h"
+#include "regex-determinize.h"
+#include "regex-matcher.h"
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Matches a record against many machines in a single pass.
+///
+/// The machines are combined with the product construction into one
+/// automaton whose states track where every machine would be, and every
+/// combined state carries the bitset of machines that accept there. The
+/// product can grow with the product of the machines' sizes, so when it
+/// would need more than `Limits::maxStates` states the machines are split in
+/// halves until every group fits, and a record is then run once per group.
+class PatternSet {
+public:
+  using state_id = CompiledMachine::state_id;
+
+  struct Limits {
+    /// States a single combined automaton may have. A group of one machine
+    /// is always kept whole, whatever its size.
+    size_t maxStates = 1 << 14;
+    /// States each pattern of `fromPatterns` may determinize to, since the
+    /// subset construction is exponential in the worst case.
+    size_t maxPatternStates = 1 << 14;
+  };
+
+private:
+  // A combined automaton over some of the machines. Its table uses the
+  // `CompiledMachine` layout and flags: index 0 rejects, the final flag is
+  // set when any member accepts and the dead flag once all members are dead.
+  // Bytes that share a class in every member share one in the group.
+  struct Group {
+    std::vector<size_t> members;
+    ByteClasses classes;
+    std::vector<state_id> table;
+    state_id startState;
+    // `acceptWords` words per state, bit `i` standing for `members[i]`.
+    std::vector<uint64_t> accepting;
+    size_t acceptWords;
+  };
+
+  struct TupleHash {
+    size_t operator()(const std::vector<state_id> &tuple) const noexcept {
+      size_t hash = tuple.size();
+      for (const auto state : tuple) {
+        hash ^= state + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+      }
+      return hash;
+    }
+  };
+
+  std::vector<CompiledMachine> _machines;
+  std::vector<Group> _groups;
+  Limits _limits;
+
+  std::optional<Group> combine(const std::vector<size_t> &members,
+                               size_t maxStates) const {
+    Group group;
+    group.members = members;
+    group.acceptWords = (members.size() + 63) / 64;
+
+    std::unordered_map<std::vector<state_id>, state_id, TupleHash> ids;
+    std::vector<std::vector<state_id>> tuples;
+    // Interns a tuple of member states, numbering it after the ones already
+    // seen. Returns `kRejectState` for tuples where every member is dead.
+    auto intern =
+        [&](const std::vector<state_id> &tuple) -> std::optional<state_id> {
+      bool allDead = true;
+      bool anyFinal = false;
+      for (const auto state : tuple) {
+        allDead = allDead && CompiledMachine::isDead(state);
+        anyFinal = anyFinal || CompiledMachine::isFinal(state);
+      }
+      if (allDead && !anyFinal) {
+        return CompiledMachine::kRejectState;
+      }
+
+      const auto it = ids.find(tuple);
+      if (it != ids.end()) {
+        return it->second;
+      }
+      if (tuples.size() == maxStates) {
+        return std::nullopt;
+      }
+
+      auto id = static_cast<state_id>(tuples.size() + 1);
+      if (anyFinal) {
+        id |= CompiledMachine::kFinalFlag;
+      }
+      if (allDead) {
+        id |= CompiledMachine::kDeadFlag;
+      }
+      group.accepting.resize(group.accepting.size() + group.acceptWords, 0);
+      auto *bits = &group.accepting[group.accepting.size() - group.acceptWords];
+      for (size_t i = 0; i < tuple.size(); ++i) {
+        if (CompiledMachine::isFinal(tuple[i])) {
+          bits[i / 64] |= uint64_t(1) << (i % 64);
+        }
+      }
+      ids.emplace(tuple, id);
+      tuples.push_back(tuple);
+      return id;
+    };
+
+    for (const auto member : members) {
+      const auto *classes = _machines[member].classes();
+      group.classes.refine([classes](size_t byte) { return classes[byte]; });
+    }
+    const auto columns = group.classes.count();
+    const auto representatives = group.classes.representatives();
+
+    // Row 0 is the reject state, which accepts nothing.
+    group.table.assign(columns, CompiledMachine::kRejectState);
+    group.accepting.assign(group.acceptWords, 0);
+
+    std::vector<state_id> start;
+    for (const auto member : members) {
+      start.push_back(_machines[member].startState());
+    }
+    const auto startState = intern(start);
+    if (!startState) {
+      return std::nullopt;
+    }
+    group.startState = *startState;
+
+    // Tuples of dead members step to themselves, so once every member is
+    // dead the combined state loops back to itself too.
+    std::vector<state_id> next(members.size());
+    for (size_t i = 0; i < tuples.size(); ++i) {
+      group.table.resize(group.table.size() + columns);
+      for (size_t c = 0; c < columns; ++c) {
+        const auto byte = static_cast<char>(representatives[c]);
+        for (size_t m = 0; m < members.size(); ++m) {
+          next[m] = _machines[members[m]].next(tuples[i][m], byte);
+        }
+        const auto target = intern(next);
+        if (!target) {
+          return std::nullopt;
+        }
+        group.table[(i + 1) * columns + c] = *target;
+      }
+    }
+    return group;
+  }
+
+  void partition(std::vector<size_t> members) {
+    const auto maxStates = members.size() == 1
+                               ? CompiledMachine::kIndexMask - 1
+                               : _limits.maxStates;
+    if (auto group = combine(members, maxStates)) {
+      _groups.push_back(std::move(*group));
+      return;
+    }
+    const auto half = members.begin() + members.size() / 2;
+    partition(std::vector<size_t>(members.begin(), half));
+    partition(std::vector<size_t>(half, members.end()));
+  }
+
+public:
+  /// Combines the machines, numbering them in the given order.
+  PatternSet(std::vector<CompiledMachine> machines, Limits limits)
+      : _machines(std::move(machines)), _limits(limits) {
+    std::vector<size_t> members(_machines.size());
+    for (size_t i = 0; i < members.size(); ++i) {
+      members[i] = i;
+    }
+    if (!members.empty()) {
+      partition(std::move(members));
+    }
+  }
+
+  explicit PatternSet(std::vector<CompiledMachine> machines)
+      : PatternSet(std::move(machines), Limits()) {}
+
+  /// Combines regex patterns, with the same syntax as `regex::Solution`, by
+  /// determinizing each of them first. Returns `std::nullopt` when a pattern
+  /// needs more than `Limits::maxPatternStates` states.
+  static std::optional<PatternSet>
+  fromPatterns(const std::vector<std::string> &patterns) {
+    return fromPatterns(patterns, Limits());
+  }
+
+  static std::optional<PatternSet>
+  fromPatterns(const std::vector<std::string> &patterns, Limits limits) {
+    std::vector<CompiledMachine> machines;
+    for (const auto &pattern : patterns) {
+      auto parser = regex::PatternParser(pattern);
+      const auto machine =
+          regex::determinize(regex::NFA(parser), limits.maxPatternStates);
+      if (!machine) {
+        return std::nullopt;
+      }
+      machines.push_back(machine->compile());
+    }
+    return PatternSet(std::move(machines), limits);
+  }
+
+  size_t size() const noexcept { return _machines.size(); }
+  size_t groupCount() const noexcept { return _groups.size(); }
+
+  /// States of all combined automata, not counting their reject states.
+  size_t stateCount() const noexcept {
+    size_t total = 0;
+    for (const auto &group : _groups) {
+      total += group.table.size() / group.classes.count() - 1;
+    }
+    return total;
+  }
+
+  /// Sets bit `i` of `results` for every machine `i` accepting `input`.
+  void matchAll(std::string_view input, ResultBitmap &results) const {
+    results.resize(size());
+    for (const auto &group : _groups) {
+      const auto columns = group.classes.count();
+      auto state = group.startState;
+      for (const auto ch : input) {
+        state = group.table[CompiledMachine::indexOf(state) * columns +
+                            group.classes[static_cast<unsigned char>(ch)]];
+        if (CompiledMachine::isDead(state)) {
+          break;
+        }
+      }
+      if (!CompiledMachine::isFinal(state)) {
+        continue;
+      }
+      const auto *bits =
+          &group.accepting[CompiledMachine::indexOf(state) * group.acceptWords];
+      for (size_t i = 0; i < group.members.size(); ++i) {
+        if ((bits[i / 64] >> (i % 64)) & 1) {
+          results.set(group.members[i], true);
+        }
+      }
+    }
+  }
+
+  /// The ids of every machine accepting `input`, in increasing order.
+  std::vector<size_t> matchAll(std::string_view input) const {
+    ResultBitmap results;
+    matchAll(input, results);
+    std::vector<size_t> ids;
+    for (size_t i = 0; i < results.size(); ++i) {
+      if (results.test(i)) {
+        ids.push_back(i);
+      }
+    }
+    return ids;
+  }
+};
+
+#endif /* PatternSet_h */
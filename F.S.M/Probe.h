@@ -0,0 +1,141 @@
+//
+//  Probe.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef Probe_h
+#define Probe_h
+
+#include <algorithm>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Instrumentation hooks for the hot paths of `Machine`, `regex::NFA` and
+/// `PDA::Automaton`, picked at compile time by passing a probe to their
+/// `accept` overloads.
+///
+/// Every hook of `NullProbe` is empty and inline, so the plain `accept`
+/// calls, which use it, compile to the same code as without any hooks.
+struct NullProbe {
+  /// A state was entered, including the start state.
+  void visit(size_t) noexcept {}
+  /// A transition was taken from the first state to the second one.
+  void transition(size_t, size_t) noexcept {}
+  /// A run through the state failed and the search went back to try
+  /// another one.
+  void backtrack(size_t) noexcept {}
+  /// Memoized work for the state was reused instead of being redone.
+  void memoHit(size_t) noexcept {}
+  /// The run stopped early because no input could lead to acceptance from
+  /// the state any more.
+  void deadExit(size_t) noexcept {}
+  /// The run was rejected because the state has no transition for the next
+  /// symbol.
+  void reject(size_t) noexcept {}
+  /// The stack grew to the given depth.
+  void stackDepth(size_t) noexcept {}
+};
+
+/// Counts every event, in total and for each state, and can dump them as a
+/// JSON heat map. Counts add up over runs until `reset()`.
+class CountingProbe {
+public:
+  struct Counters {
+    size_t visits = 0;
+    size_t transitions = 0;
+    size_t backtracks = 0;
+    size_t memoHits = 0;
+    size_t deadExits = 0;
+    size_t rejects = 0;
+  };
+
+private:
+  std::unordered_map<size_t, Counters> _states;
+  Counters _totals;
+  size_t _maxStackDepth = 0;
+
+  static void writeCounters(std::ostream &out, const Counters &counters) {
+    out << "\"visits\": " << counters.visits
+        << ", \"transitions\": " << counters.transitions
+        << ", \"backtracks\": " << counters.backtracks
+        << ", \"memoHits\": " << counters.memoHits
+        << ", \"deadExits\": " << counters.deadExits
+        << ", \"rejects\": " << counters.rejects;
+  }
+
+public:
+  void visit(size_t state) {
+    ++_states[state].visits;
+    ++_totals.visits;
+  }
+
+  void transition(size_t from, size_t) {
+    ++_states[from].transitions;
+    ++_totals.transitions;
+  }
+
+  void backtrack(size_t state) {
+    ++_states[state].backtracks;
+    ++_totals.backtracks;
+  }
+
+  void memoHit(size_t state) {
+    ++_states[state].memoHits;
+    ++_totals.memoHits;
+  }
+
+  void deadExit(size_t state) {
+    ++_states[state].deadExits;
+    ++_totals.deadExits;
+  }
+
+  void reject(size_t state) {
+    ++_states[state].rejects;
+    ++_totals.rejects;
+  }
+
+  void stackDepth(size_t depth) noexcept {
+    _maxStackDepth = std::max(_maxStackDepth, depth);
+  }
+
+  const Counters &totals() const noexcept { return _totals; }
+  size_t maxStackDepth() const noexcept { return _maxStackDepth; }
+
+  Counters forState(size_t state) const {
+    const auto it = _states.find(state);
+    return it == _states.end() ? Counters() : it->second;
+  }
+
+  void reset() {
+    _states.clear();
+    _totals = Counters();
+    _maxStackDepth = 0;
+  }
+
+  /// Writes the totals and the counters of every state seen, sorted by
+  /// state, as a JSON object.
+  void dumpJson(std::ostream &out) const {
+    std::vector<std::pair<size_t, Counters>> states(_states.begin(),
+                                                    _states.end());
+    std::sort(states.begin(), states.end(),
+              [](const auto &lhs, const auto &rhs) {
+                return lhs.first < rhs.first;
+              });
+
+    out << "{\"totals\": {";
+    writeCounters(out, _totals);
+    out << ", \"maxStackDepth\": " << _maxStackDepth << "}, \"states\": [";
+    for (size_t i = 0; i < states.size(); ++i) {
+      out << (i ? ", " : "") << "{\"state\": " << states[i].first << ", ";
+      writeCounters(out, states[i].second);
+      out << "}";
+    }
+    out << "]}";
+  }
+};
+
+#endif /* Probe_h */
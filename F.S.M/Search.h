@@ -0,0 +1,399 @@
+//
+//  Search.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef Search_h
+#define Search_h
+
+#include "FSM.h"
+#include "regex-matcher.h"
+#include <array>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// A match of a whole automaton found somewhere in a larger buffer, as the
+/// half open byte range `[begin, end)`.
+struct Match {
+  size_t begin;
+  size_t end;
+
+  bool operator==(const Match &rhs) const {
+    return begin == rhs.begin && end == rhs.end;
+  }
+};
+
+/// Cheap checks that rule out most positions before an automaton is run.
+///
+/// `startBytes` are the bytes a non empty match can start with. When there
+/// are only a few of them the buffer is scanned for them with `memchr` or
+/// SSE2 compares instead of byte by byte. `requiredByte` is a byte every
+/// match contains; once it no longer occurs in the rest of the buffer there
+/// can be no more matches.
+class Prefilter {
+  static constexpr size_t kMaxScanBytes = 3;
+
+  std::array<bool, 256> _startBytes{};
+  std::vector<unsigned char> _scanBytes;
+  std::optional<unsigned char> _requiredByte;
+  bool _matchesEmpty = false;
+
+  size_t scan(std::string_view text, size_t pos) const noexcept {
+    const auto *data = reinterpret_cast<const unsigned char *>(text.data());
+    if (_scanBytes.size() == 1) {
+      const auto *found =
+          std::memchr(data + pos, _scanBytes[0], text.size() - pos);
+      return found ? static_cast<const unsigned char *>(found) - data
+                   : std::string_view::npos;
+    }
+
+#if defined(__SSE2__)
+    if (!_scanBytes.empty()) {
+      __m128i needles[kMaxScanBytes];
+      for (size_t i = 0; i < kMaxScanBytes; ++i) {
+        // Repeat the first byte to fill unused needles.
+        needles[i] = _mm_set1_epi8(static_cast<char>(
+            _scanBytes[i < _scanBytes.size() ? i : 0]));
+      }
+      for (; pos + 16 <= text.size(); pos += 16) {
+        const auto block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(data + pos));
+        auto hits = _mm_cmpeq_epi8(block, needles[0]);
+        for (size_t i = 1; i < kMaxScanBytes; ++i) {
+          hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[i]));
+        }
+        if (const auto mask = _mm_movemask_epi8(hits)) {
+          return pos + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+      }
+    }
+#endif
+
+    for (; pos < text.size(); ++pos) {
+      if (_startBytes[data[pos]]) {
+        return pos;
+      }
+    }
+    return std::string_view::npos;
+  }
+
+public:
+  Prefilter(const std::array<bool, 256> &startBytes,
+            std::optional<unsigned char> requiredByte, bool matchesEmpty)
+      : _startBytes(startBytes), _requiredByte(requiredByte),
+        _matchesEmpty(matchesEmpty) {
+    for (size_t byte = 0; byte < 256; ++byte) {
+      if (_startBytes[byte]) {
+        _scanBytes.push_back(static_cast<unsigned char>(byte));
+      }
+    }
+    if (_scanBytes.size() > kMaxScanBytes) {
+      _scanBytes.clear();
+    }
+  }
+
+  /// Whether an empty match is possible, in which case every position is a
+  /// candidate.
+  bool matchesEmpty() const noexcept { return _matchesEmpty; }
+
+  /// The first position at or after `pos` a match can begin at, or `npos`.
+  /// `requiredAt` caches where the required byte was last seen, so it is
+  /// only searched for again once the scan has moved past it.
+  size_t nextCandidate(std::string_view text, size_t pos,
+                       size_t &requiredAt) const noexcept {
+    if (pos > text.size()) {
+      return std::string_view::npos;
+    }
+    if (_matchesEmpty) {
+      return pos;
+    }
+    if (_requiredByte &&
+        (requiredAt < pos || requiredAt >= text.size() ||
+         static_cast<unsigned char>(text[requiredAt]) != *_requiredByte)) {
+      const auto *found =
+          std::memchr(text.data() + pos, *_requiredByte, text.size() - pos);
+      if (!found) {
+        return std::string_view::npos;
+      }
+      requiredAt = static_cast<const char *>(found) - text.data();
+    }
+    return scan(text, pos);
+  }
+};
+
+/// Runs a searcher's `matchAt` from every candidate position of its
+/// prefilter. Shared by the `Machine` and regex searchers.
+///
+/// Each candidate runs until it accepts or can no longer match, so a search
+/// over `n` bytes costs O(n x m), where `m` is the longest of those runs:
+/// quadratic in the worst case, e.g. a long run of a start byte that never
+/// completes a match. `findAll` pays this again from the end of every match.
+template <class Searcher>
+class SearchBase {
+public:
+  /// The match with the leftmost beginning and, for that beginning, the
+  /// shortest length.
+  std::optional<Match> findFirst(std::string_view text, size_t from = 0) const {
+    const auto &self = static_cast<const Searcher &>(*this);
+    const auto &prefilter = self.prefilter();
+    size_t requiredAt = 0;
+    for (auto pos = prefilter.nextCandidate(text, from, requiredAt);
+         pos != std::string_view::npos;
+         pos = prefilter.nextCandidate(text, pos + 1, requiredAt)) {
+      const auto length = self.matchAt(text.substr(pos));
+      if (length != std::string_view::npos) {
+        return Match{pos, pos + length};
+      }
+    }
+    return std::nullopt;
+  }
+
+  /// Every non overlapping match, left to right.
+  std::vector<Match> findAll(std::string_view text) const {
+    std::vector<Match> matches;
+    size_t from = 0;
+    while (const auto match = findFirst(text, from)) {
+      matches.push_back(*match);
+      from = match->end > match->begin ? match->end : match->begin + 1;
+    }
+    return matches;
+  }
+};
+
+/// Searches for substrings accepted by a `CompiledMachine`.
+///
+/// The required bytes are the ones every accepted string has to contain,
+/// found by checking which labels the start state can't reach a final state
+/// without, e.g. `a`, `b` and `c` for a machine accepting strings containing
+/// "abc". To only ask whether there is a match, `contains` avoids the
+/// worst case of `findFirst`.
+class MachineSearcher : public SearchBase<MachineSearcher> {
+  using state_id = CompiledMachine::state_id;
+
+  CompiledMachine _machine;
+  Prefilter _prefilter;
+
+  // Whether a final state is reachable without reading bytes of class
+  // `withoutClass`. Bytes of a class lead to the same states, so one
+  // representative byte stands for each.
+  static bool canReachFinal(const CompiledMachine &machine,
+                            const std::vector<unsigned char> &representatives,
+                            std::optional<size_t> withoutClass) {
+    std::vector<bool> visited(machine.stateCount(), false);
+    std::vector<state_id> stack{machine.startState()};
+    visited[CompiledMachine::indexOf(machine.startState())] = true;
+    while (!stack.empty()) {
+      const auto state = stack.back();
+      stack.pop_back();
+      if (CompiledMachine::isFinal(state)) {
+        return true;
+      }
+      for (size_t c = 0; c < representatives.size(); ++c) {
+        if (withoutClass && c == *withoutClass) {
+          continue;
+        }
+        const auto next =
+            machine.next(state, static_cast<char>(representatives[c]));
+        if (!visited[CompiledMachine::indexOf(next)]) {
+          visited[CompiledMachine::indexOf(next)] = true;
+          stack.push_back(next);
+        }
+      }
+    }
+    return false;
+  }
+
+  static Prefilter makePrefilter(const CompiledMachine &machine) {
+    // A byte is useful when it can lead somewhere other than a dead end.
+    auto isUseful = [](state_id target) {
+      return !CompiledMachine::isDead(target) ||
+             CompiledMachine::isFinal(target);
+    };
+
+    // Every question here has the same answer for the bytes of a class, so
+    // it is asked once per class.
+    const auto classCount = machine.classCount();
+    std::vector<unsigned char> representatives(classCount);
+    std::vector<size_t> classSizes(classCount, 0);
+    for (size_t byte = 256; byte-- > 0;) {
+      const auto c = machine.classOf(static_cast<char>(byte));
+      representatives[c] = static_cast<unsigned char>(byte);
+      ++classSizes[c];
+    }
+
+    const auto start = machine.startState();
+    std::vector<bool> startClasses(classCount);
+    std::vector<bool> usedClasses(classCount, false);
+    for (size_t c = 0; c < classCount; ++c) {
+      const auto ch = static_cast<char>(representatives[c]);
+      startClasses[c] = isUseful(machine.next(start, ch));
+      for (size_t state = 0; state < machine.stateCount() && !usedClasses[c];
+           ++state) {
+        usedClasses[c] = isUseful(machine.next(state_id(state), ch));
+      }
+    }
+    std::array<bool, 256> startBytes{};
+    for (size_t byte = 0; byte < 256; ++byte) {
+      startBytes[byte] = startClasses[machine.classOf(static_cast<char>(byte))];
+    }
+
+    // Other bytes of a class can stand in for any one of them, so only a
+    // class of a single byte can hold a required byte.
+    std::optional<unsigned char> requiredByte;
+    if (canReachFinal(machine, representatives, std::nullopt)) {
+      for (size_t c = 0; c < classCount && !requiredByte; ++c) {
+        if (classSizes[c] == 1 && usedClasses[c] &&
+            !canReachFinal(machine, representatives, c)) {
+          requiredByte = representatives[c];
+        }
+      }
+    }
+    return Prefilter(startBytes, requiredByte,
+                     CompiledMachine::isFinal(start));
+  }
+
+public:
+  /// Shares the machine's table, which copying a `CompiledMachine` doesn't
+  /// duplicate.
+  explicit MachineSearcher(CompiledMachine machine)
+      : _machine(std::move(machine)), _prefilter(makePrefilter(_machine)) {}
+
+  const Prefilter &prefilter() const noexcept { return _prefilter; }
+
+  /// Whether a match begins anywhere in `text`, in a single pass. A run
+  /// starts at every position, and runs that reach the same state are
+  /// merged, since they share their future, so a byte costs at most one
+  /// step per state: O(n x states) where `findFirst` can take O(n x m).
+  bool contains(std::string_view text) const {
+    if (CompiledMachine::isFinal(_machine.startState())) {
+      return true;
+    }
+    // Reused across calls, so scanning many short lines doesn't allocate.
+    thread_local std::vector<state_id> runs;
+    thread_local std::vector<state_id> next;
+    thread_local std::vector<bool> seen;
+    runs.clear();
+    seen.assign(_machine.stateCount(), false);
+
+    size_t requiredAt = 0;
+    for (size_t pos = 0; pos < text.size(); ++pos) {
+      if (runs.empty()) {
+        pos = _prefilter.nextCandidate(text, pos, requiredAt);
+        if (pos == std::string_view::npos) {
+          return false;
+        }
+      }
+      runs.push_back(_machine.startState());
+      next.clear();
+      for (const auto state : runs) {
+        const auto target = _machine.next(state, text[pos]);
+        if (CompiledMachine::isFinal(target)) {
+          return true;
+        }
+        const auto index = CompiledMachine::indexOf(target);
+        if (!CompiledMachine::isDead(target) && !seen[index]) {
+          seen[index] = true;
+          next.push_back(target);
+        }
+      }
+      for (const auto state : next) {
+        seen[CompiledMachine::indexOf(state)] = false;
+      }
+      std::swap(runs, next);
+    }
+    return false;
+  }
+
+  /// Length of the shortest accepted prefix of `text`, or `npos`.
+  size_t matchAt(std::string_view text) const noexcept {
+    auto state = _machine.startState();
+    for (size_t i = 0;; ++i) {
+      if (CompiledMachine::isFinal(state)) {
+        return i;
+      }
+      if (i == text.size() || CompiledMachine::isDead(state)) {
+        return std::string_view::npos;
+      }
+      state = _machine.next(state, text[i]);
+    }
+  }
+};
+
+namespace regex {
+// Searches for substrings matching a pattern.
+//
+// A match has to start with one of the leading starred tokens or the first
+// required one, and has to contain every required literal token, which is
+// what the prefilter looks for.
+class Searcher : public SearchBase<Searcher> {
+  std::variant<ShiftAndMatcher, WideShiftAndMatcher> mEngine;
+  Prefilter mPrefilter;
+
+  static std::vector<Token> tokenize(const std::string &pattern) {
+    std::vector<Token> tokens;
+    auto tokenizer = PatternParser(pattern);
+    while (tokenizer.canGet()) {
+      tokens.push_back(tokenizer.next());
+    }
+    return tokens;
+  }
+
+  static decltype(mEngine) makeEngine(const std::vector<Token> &tokens) {
+    if (ShiftAndMatcher::fits(tokens)) {
+      return ShiftAndMatcher(tokens);
+    }
+    return WideShiftAndMatcher(tokens);
+  }
+
+  static Prefilter makePrefilter(const std::vector<Token> &tokens) {
+    std::array<bool, 256> startBytes{};
+    bool matchesEmpty = true;
+    for (const auto &token : tokens) {
+      if (token.getValue() == '.') {
+        startBytes.fill(true);
+      } else {
+        startBytes[static_cast<unsigned char>(token.getValue())] = true;
+      }
+      if (!token.isZeroOrMore()) {
+        matchesEmpty = false;
+        break;
+      }
+    }
+
+    std::optional<unsigned char> requiredByte;
+    for (const auto &token : tokens) {
+      if (!token.isZeroOrMore() && token.getValue() != '.') {
+        requiredByte = static_cast<unsigned char>(token.getValue());
+        break;
+      }
+    }
+    return Prefilter(startBytes, requiredByte, matchesEmpty);
+  }
+
+  explicit Searcher(const std::vector<Token> &tokens)
+      : mEngine(makeEngine(tokens)), mPrefilter(makePrefilter(tokens)) {}
+
+public:
+  explicit Searcher(const std::string &pattern) : Searcher(tokenize(pattern)) {}
+
+  const Prefilter &prefilter() const noexcept { return mPrefilter; }
+
+  // Length of the shortest prefix of `text` matching the pattern, or `npos`.
+  size_t matchAt(std::string_view text) const {
+    return std::visit(
+        [text](const auto &engine) { return engine.shortestPrefix(text); },
+        mEngine);
+  }
+};
+} // namespace regex
+
+#endif /* Search_h */
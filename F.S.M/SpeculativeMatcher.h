@@ -0,0 +1,147 @@
+//
+//  SpeculativeMatcher.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef SpeculativeMatcher_h
+#define SpeculativeMatcher_h
+
+#include "FSM.h"
+#include "ThreadPool.h"
+#include <string_view>
+#include <vector>
+
+/// Accepts a single large input on several threads.
+///
+/// The input is split in chunks and, since the state a chunk starts in is
+/// only known once the previous one is done, every chunk but the first is
+/// simulated from all states at once. That gives each chunk a state to state
+/// mapping, and composing the mappings in order yields exactly the state a
+/// sequential run ends in. This is cheap for machines with a handful of
+/// states, and runs started from different states usually merge after a few
+/// bytes, after which they are only simulated once.
+class SpeculativeMatcher {
+public:
+  using state_id = CompiledMachine::state_id;
+
+  /// Inputs shorter than two chunks of this size are run sequentially.
+  static constexpr size_t kDefaultMinChunkSize = 1 << 16;
+
+private:
+  // Runs from different states are merged every this many bytes.
+  static constexpr size_t kMergeInterval = 64;
+
+  // Runs `chunk` from every state and stores in `mapping[i]` the state a run
+  // started at index `i` ends in.
+  static void simulateFromAll(const CompiledMachine &machine,
+                              std::string_view chunk,
+                              std::vector<state_id> &mapping) {
+    const auto stateCount = machine.stateCount();
+
+    // Plain indices are fine as starting points: flags only matter once a
+    // run has taken a step, and dead rows loop back to themselves.
+    std::vector<state_id> runs(stateCount);
+    std::vector<size_t> runOf(stateCount);
+    for (size_t i = 0; i < stateCount; ++i) {
+      runs[i] = static_cast<state_id>(i);
+      runOf[i] = i;
+    }
+
+    std::vector<size_t> merged(stateCount);
+    std::vector<size_t> seen(stateCount);
+    for (size_t pos = 0; pos < chunk.size() && !runs.empty();
+         pos += kMergeInterval) {
+      const auto block = chunk.substr(pos, kMergeInterval);
+      for (auto &state : runs) {
+        for (const auto ch : block) {
+          if (CompiledMachine::isDead(state)) {
+            break;
+          }
+          state = machine.next(state, ch);
+        }
+      }
+
+      // Merge runs that reached the same state. `seen` holds one past the
+      // surviving run of each state index.
+      std::fill(seen.begin(), seen.end(), 0);
+      size_t survivors = 0;
+      for (size_t r = 0; r < runs.size(); ++r) {
+        auto &slot = seen[CompiledMachine::indexOf(runs[r])];
+        if (slot == 0) {
+          runs[survivors] = runs[r];
+          slot = ++survivors;
+        }
+        merged[r] = slot - 1;
+      }
+      runs.resize(survivors);
+      for (auto &run : runOf) {
+        run = merged[run];
+      }
+      if (runs.size() == 1) {
+        // Every run agrees, just finish the chunk once.
+        auto &state = runs.front();
+        for (const auto ch : chunk.substr(pos + block.size())) {
+          if (CompiledMachine::isDead(state)) {
+            break;
+          }
+          state = machine.next(state, ch);
+        }
+        break;
+      }
+    }
+
+    mapping.resize(stateCount);
+    for (size_t i = 0; i < stateCount; ++i) {
+      mapping[i] = runs[runOf[i]];
+    }
+  }
+
+public:
+  /// Returns the same verdict as `machine.accept(input)`.
+  static bool accept(const CompiledMachine &machine, std::string_view input,
+                     WorkStealingPool &pool,
+                     size_t minChunkSize = kDefaultMinChunkSize) {
+    // A few chunks per worker lets stealing even out chunks that merge late.
+    const auto targetCount = std::min(pool.threadCount() * 4,
+                                      input.size() / std::max<size_t>(
+                                                         minChunkSize, 1));
+    if (targetCount <= 1) {
+      return machine.accept(input);
+    }
+
+    // Rounding the size up can leave fewer chunks than targeted, so the
+    // count follows from the size: every chunk then starts inside the input
+    // and none is empty.
+    const auto chunkSize = (input.size() + targetCount - 1) / targetCount;
+    const auto chunkCount = (input.size() + chunkSize - 1) / chunkSize;
+    auto chunkAt = [&](size_t chunk) {
+      return input.substr(chunk * chunkSize, chunkSize);
+    };
+
+    // The first chunk's starting state is known, so it is run once.
+    state_id firstState = machine.startState();
+    std::vector<std::vector<state_id>> mappings(chunkCount);
+    pool.parallelFor(chunkCount, [&](size_t chunk) {
+      if (chunk > 0) {
+        simulateFromAll(machine, chunkAt(chunk), mappings[chunk]);
+        return;
+      }
+      for (const auto ch : chunkAt(0)) {
+        if (CompiledMachine::isDead(firstState)) {
+          break;
+        }
+        firstState = machine.next(firstState, ch);
+      }
+    });
+
+    auto state = firstState;
+    for (size_t chunk = 1; chunk < chunkCount; ++chunk) {
+      state = mappings[chunk][CompiledMachine::indexOf(state)];
+    }
+    return CompiledMachine::isFinal(state);
+  }
+};
+
+#endif /* SpeculativeMatcher_h */
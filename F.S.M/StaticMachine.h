@@ -0,0 +1,262 @@
+//
+//  StaticMachine.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef StaticMachine_h
+#define StaticMachine_h
+
+#include "FSM.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string_view>
+#include <type_traits>
+
+/// A DFA over a small alphabet that is built entirely at compile time, so it
+/// can be declared as a `constexpr` constant whose table lives in read-only
+/// data and costs nothing at startup.
+///
+/// States are numbered `[0, NStates)` and symbols are numbered by their
+/// position in the alphabet, so the table is `NStates x NSymbols` entries of
+/// the smallest type that fits a state: six states over "01" take twelve
+/// bytes. Alphabets that are a contiguous range of bytes, like "01" or
+/// "abc", are indexed by subtracting the first byte; others go through a
+/// byte to symbol table.
+///
+/// Mistakes while building, like a transition to a state that doesn't exist
+/// or two transitions for the same symbol, are recorded in `error()` instead
+/// of asserting, and `staticAccept` turns them into `static_assert` failures.
+template <size_t NStates, size_t NSymbols> class StaticMachine {
+  static_assert(NStates > 0, "A machine needs a start state");
+  static_assert(NSymbols > 0 && NSymbols <= 256,
+                "Alphabets have between 1 and 256 symbols");
+
+public:
+  /// The smallest unsigned type that fits every state and `kNoState`.
+  using state_id = std::conditional_t<
+      (NStates < UINT8_MAX), uint8_t,
+      std::conditional_t<(NStates < UINT16_MAX), uint16_t, uint32_t>>;
+  using symbol_id = std::conditional_t<(NSymbols < UINT8_MAX), uint8_t,
+                                       uint16_t>;
+
+  /// Target of missing transitions, which reject.
+  static constexpr state_id kNoState = NStates;
+  /// Symbol of bytes that aren't in the alphabet.
+  static constexpr symbol_id kNoSymbol = NSymbols;
+
+  enum class Error {
+    None,
+    RepeatedSymbol,
+    StartStateOutOfRange,
+    FinalStateOutOfRange,
+    StateOutOfRange,
+    SymbolNotInAlphabet,
+    ConflictingTransition,
+  };
+
+private:
+  std::array<char, NSymbols> _alphabet{};
+  std::array<symbol_id, 256> _symbols{};
+  unsigned char _firstSymbol = 0;
+  bool _contiguous = true;
+  std::array<std::array<state_id, NSymbols>, NStates> _table{};
+  std::array<bool, NStates> _finalStates{};
+  std::array<bool, NStates> _deadStates{};
+  state_id _startState = 0;
+  Error _error = Error::None;
+
+  // Keeps the first error, which is the one to fix first.
+  constexpr void fail(Error error) noexcept {
+    if (_error == Error::None) {
+      _error = error;
+    }
+  }
+
+  // Same as `Machine::isSink`: a non final state that only loops on itself.
+  constexpr bool isSink(size_t state) const noexcept {
+    if (_finalStates[state]) {
+      return false;
+    }
+    for (const auto toState : _table[state]) {
+      if (toState != kNoState && toState != state) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+public:
+  /// `alphabet` is a string literal with every symbol the machine reads,
+  /// e.g. "01".
+  constexpr StaticMachine(const char (&alphabet)[NSymbols + 1],
+                          size_t startState,
+                          std::initializer_list<size_t> finalStates) {
+    for (auto &symbol : _symbols) {
+      symbol = kNoSymbol;
+    }
+    _firstSymbol = static_cast<unsigned char>(alphabet[0]);
+    for (size_t i = 0; i < NSymbols; ++i) {
+      const auto byte = static_cast<unsigned char>(alphabet[i]);
+      if (_symbols[byte] != kNoSymbol) {
+        fail(Error::RepeatedSymbol);
+      }
+      _alphabet[i] = alphabet[i];
+      _symbols[byte] = static_cast<symbol_id>(i);
+      _contiguous = _contiguous && byte == _firstSymbol + i;
+    }
+
+    for (auto &row : _table) {
+      for (auto &toState : row) {
+        toState = kNoState;
+      }
+    }
+
+    if (startState < NStates) {
+      _startState = static_cast<state_id>(startState);
+    } else {
+      fail(Error::StartStateOutOfRange);
+    }
+    for (const auto state : finalStates) {
+      if (state < NStates) {
+        _finalStates[state] = true;
+      } else {
+        fail(Error::FinalStateOutOfRange);
+      }
+    }
+    for (size_t state = 0; state < NStates; ++state) {
+      _deadStates[state] = isSink(state);
+    }
+  }
+
+  constexpr void addTransition(size_t state, char input, size_t toState) {
+    if (state >= NStates || toState >= NStates) {
+      fail(Error::StateOutOfRange);
+      return;
+    }
+    const auto symbol = classify(input);
+    if (symbol == kNoSymbol) {
+      fail(Error::SymbolNotInAlphabet);
+      return;
+    }
+    auto &entry = _table[state][symbol];
+    if (entry != kNoState && entry != toState) {
+      fail(Error::ConflictingTransition);
+      return;
+    }
+    entry = static_cast<state_id>(toState);
+    _deadStates[state] = isSink(state);
+  }
+
+  constexpr Error error() const noexcept { return _error; }
+  constexpr bool isValid() const noexcept { return _error == Error::None; }
+
+  /// Whether the alphabet is a range of consecutive bytes, which `classify`
+  /// can index without a table.
+  constexpr bool isContiguous() const noexcept { return _contiguous; }
+
+  constexpr size_t stateCount() const noexcept { return NStates; }
+  constexpr size_t symbolCount() const noexcept { return NSymbols; }
+
+  /// The symbol number of `ch`, or `kNoSymbol` when it isn't in the
+  /// alphabet.
+  constexpr symbol_id classify(char ch) const noexcept {
+    const auto byte = static_cast<unsigned char>(ch);
+    if (_contiguous) {
+      const auto offset = static_cast<unsigned char>(byte - _firstSymbol);
+      return offset < NSymbols ? static_cast<symbol_id>(offset) : kNoSymbol;
+    }
+    return _symbols[byte];
+  }
+
+  constexpr state_id getStartState() const noexcept { return _startState; }
+
+  constexpr bool isFinalState(size_t state) const noexcept {
+    return state < NStates && _finalStates[state];
+  }
+
+  constexpr bool isDeadState(size_t state) const noexcept {
+    return state < NStates && _deadStates[state];
+  }
+
+  /// The state `ch` leads to from `state`, or `kNoState`.
+  constexpr state_id next(size_t state, char ch) const noexcept {
+    const auto symbol = classify(ch);
+    return symbol == kNoSymbol ? kNoState : _table[state][symbol];
+  }
+
+  /// Same as `Machine::accept`, and usable in constant expressions.
+  constexpr bool accept(std::string_view str) const noexcept {
+    size_t state = _startState;
+    for (const auto ch : str) {
+      state = next(state, ch);
+      if (state == kNoState) {
+        return false;
+      }
+      if (_deadStates[state]) {
+        break;
+      }
+    }
+    return _finalStates[state];
+  }
+
+  /// A runtime `Machine` with the same states and transitions.
+  Machine toMachine() const {
+    Machine::state_set states;
+    Machine::state_set finalStates;
+    for (size_t state = 0; state < NStates; ++state) {
+      states.insert(state);
+      if (_finalStates[state]) {
+        finalStates.insert(state);
+      }
+    }
+    Machine machine(states, _startState, finalStates);
+    for (size_t state = 0; state < NStates; ++state) {
+      for (size_t symbol = 0; symbol < NSymbols; ++symbol) {
+        if (_table[state][symbol] != kNoState) {
+          machine.addTransition(state, _alphabet[symbol],
+                                _table[state][symbol]);
+        }
+      }
+    }
+    return machine;
+  }
+};
+
+/// Runs the `constexpr` machine `M` over `str`, with a loop specialized for
+/// it: the table's address and size, and whether bytes are classified by a
+/// subtraction or a lookup, are all compile time constants. Fails to compile
+/// when `M` was built with a mistake.
+template <const auto &M> bool staticAccept(std::string_view str) noexcept {
+  using machine = std::remove_cv_t<std::remove_reference_t<decltype(M)>>;
+  using Error = typename machine::Error;
+  static_assert(M.error() != Error::RepeatedSymbol,
+                "A symbol appears twice in the alphabet");
+  static_assert(M.error() != Error::StartStateOutOfRange,
+                "The start state isn't one of the machine's states");
+  static_assert(M.error() != Error::FinalStateOutOfRange,
+                "A final state isn't one of the machine's states");
+  static_assert(M.error() != Error::StateOutOfRange,
+                "A transition uses a state that isn't one of the machine's");
+  static_assert(M.error() != Error::SymbolNotInAlphabet,
+                "A transition reads a symbol that isn't in the alphabet");
+  static_assert(M.error() != Error::ConflictingTransition,
+                "A state has two transitions for the same symbol");
+
+  size_t state = M.getStartState();
+  for (const auto ch : str) {
+    state = M.next(state, ch);
+    if (state == machine::kNoState) {
+      return false;
+    }
+    if (M.isDeadState(state)) {
+      break;
+    }
+  }
+  return M.isFinalState(state);
+}
+
+#endif /* StaticMachine_h */
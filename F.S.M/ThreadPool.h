@@ -0,0 +1,189 @@
+//
+//  ThreadPool.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A fixed size thread pool where every worker owns a task queue. Workers
+/// pop from the back of their own queue and steal from the front of the
+/// others' queues once they run dry, so uneven tasks still spread evenly.
+class WorkStealingPool {
+  // A `parallelFor` call in flight. It lives on the caller's stack, which
+  // does not return before every task of the job has finished.
+  struct Job {
+    void (*run)(const void *fn, size_t index);
+    const void *fn;
+    std::atomic<size_t> remaining;
+  };
+
+  struct Task {
+    Job *job;
+    size_t index;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> _queues;
+  std::vector<std::thread> _threads;
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _done;
+  std::atomic<size_t> _pending{0};
+  bool _stop = false;
+
+  bool popOwn(size_t worker, Task &task) {
+    auto &queue = *_queues[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(size_t thief, Task &task) {
+    for (size_t i = 1; i <= _queues.size(); ++i) {
+      auto &queue = *_queues[(thief + i) % _queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool tryRunOne(size_t worker) {
+    Task task;
+    if (!popOwn(worker, task) && !steal(worker, task)) {
+      return false;
+    }
+    _pending.fetch_sub(1, std::memory_order_relaxed);
+    task.job->run(task.job->fn, task.index);
+    if (task.job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // Take the lock so the notification can't slip in between the
+      // waiter's check and its wait.
+      std::lock_guard<std::mutex> lock(_mutex);
+      _done.notify_all();
+    }
+    return true;
+  }
+
+  void workerLoop(size_t worker) {
+    while (true) {
+      if (tryRunOne(worker)) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait(lock, [this] {
+        return _stop || _pending.load(std::memory_order_relaxed) > 0;
+      });
+      if (_stop) {
+        return;
+      }
+    }
+  }
+
+public:
+  /// Creates a pool with `threadCount` workers, or one per hardware thread
+  /// when it is zero.
+  explicit WorkStealingPool(size_t threadCount = 0) {
+    if (threadCount == 0) {
+      threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+      _queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+      _threads.emplace_back([this, i] { workerLoop(i); });
+    }
+  }
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &thread : _threads) {
+      thread.join();
+    }
+  }
+
+  size_t threadCount() const noexcept { return _threads.size(); }
+
+  /// Runs `fn(i)` for every `i` in `[0, count)` and returns once all of them
+  /// are done. The calling thread helps running tasks while it waits.
+  template <class Fn>
+  void parallelFor(size_t count, const Fn &fn) {
+    if (count == 0) {
+      return;
+    }
+
+    Job job{[](const void *f, size_t index) {
+              (*static_cast<const Fn *>(f))(index);
+            },
+            &fn, {count}};
+
+    // Count the tasks before publishing them so a worker that grabs one
+    // early never sees the pending count underflow.
+    _pending.fetch_add(count, std::memory_order_relaxed);
+
+    // Deal the tasks in contiguous runs so neighbouring indices, which
+    // usually touch neighbouring memory, stay on the same worker.
+    const auto workers = _queues.size();
+    const auto perWorker = (count + workers - 1) / workers;
+    for (size_t worker = 0; worker < workers; ++worker) {
+      const auto begin = worker * perWorker;
+      const auto end = std::min(count, begin + perWorker);
+      if (begin >= end) {
+        break;
+      }
+      auto &queue = *_queues[worker];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      for (size_t i = begin; i < end; ++i) {
+        queue.tasks.push_back({&job, i});
+      }
+    }
+    {
+      // Sleeping workers test the pending count under this lock, so taking
+      // it once orders the increment before their wait.
+      std::lock_guard<std::mutex> lock(_mutex);
+    }
+    _wake.notify_all();
+
+    while (job.remaining.load(std::memory_order_acquire) > 0) {
+      if (tryRunOne(0)) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(_mutex);
+      _done.wait(lock, [&job] {
+        return job.remaining.load(std::memory_order_acquire) == 0;
+      });
+    }
+  }
+};
+
+#endif /* ThreadPool_h */
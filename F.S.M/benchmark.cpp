@@ -0,0 +1,324 @@
+//
+//  benchmark.cpp
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#include "ExampleMachines.h"
+#include "FSM.h"
+#include "JitMachine.h"
+#include "PDA.h"
+#include "regex-lazy-dfa.h"
+#include "regex-matcher.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define FSM_BENCHMARK_HAS_FORK 1
+#else
+#define FSM_BENCHMARK_HAS_FORK 0
+#endif
+
+// Every heap allocation goes through here so allocations per match can be
+// reported. Allocation and deallocation stay out of line, so the compiler
+// pairs callers' `new` with `delete` rather than the `malloc` and `free`
+// behind them, which it would take for a mismatch.
+static std::atomic<size_t> allocations{0};
+
+[[gnu::noinline]] void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+[[gnu::noinline]] void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { operator delete(ptr); }
+
+// Peak resident memory of the process so far in KiB, or 0 when unknown.
+// Engines run in a process of their own, so there it is the engine's peak.
+static size_t peakMemoryKiB() {
+#if FSM_BENCHMARK_HAS_FORK
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+struct Workload {
+  std::string name;
+  std::vector<std::string> inputs;
+
+  size_t bytes() const {
+    size_t total = 0;
+    for (const auto &input : inputs) {
+      total += input.size();
+    }
+    return total;
+  }
+};
+
+// `count` strings of `length` symbols drawn uniformly from `alphabet`.
+static Workload randomStrings(std::string name, std::string_view alphabet,
+                              size_t count, size_t length) {
+  std::mt19937_64 random(42);
+  Workload workload{std::move(name), {}};
+  for (size_t i = 0; i < count; ++i) {
+    std::string input(length, '\0');
+    for (auto &ch : input) {
+      ch = alphabet[random() % alphabet.size()];
+    }
+    workload.inputs.push_back(std::move(input));
+  }
+  return workload;
+}
+
+// 0^n 1^n, which needs a stack n symbols deep.
+static Workload nestedZerosOnes(size_t n) {
+  return {"nested-0n1n-" + std::to_string(n),
+          {std::string(n, '0') + std::string(n, '1')}};
+}
+
+// A pattern of `stars` "a*" followed by a "b", and runs of "a" without the
+// "b". Every way of spreading the run over the stars fails, which is what
+// backtracking matchers blow up on.
+static std::string starsPattern(size_t stars) {
+  std::string pattern;
+  for (size_t i = 0; i < stars; ++i) {
+    pattern += "a*";
+  }
+  return pattern + "b";
+}
+
+static Workload unmatchedRuns(size_t count, size_t length) {
+  return {"runs-of-a-" + std::to_string(length),
+          std::vector<std::string>(count, std::string(length, 'a'))};
+}
+
+static PDA::Automaton makeZerosThenOnes() {
+  const auto e = PDA::Symbol::epsilon();
+  PDA::Automaton automaton(0, {0, 1, 2, 3}, {3});
+  automaton.addTransition(0, 1, e, e, {'$'});
+  automaton.addTransition(1, 1, {'0'}, e, {'0'});
+  automaton.addTransition(1, 2, e, e, e);
+  automaton.addTransition(2, 2, {'1'}, {'0'}, e);
+  automaton.addTransition(2, 3, e, {'$'}, e);
+  return automaton;
+}
+
+static volatile size_t sink;
+
+struct Options {
+  double minSeconds = 0.5;
+  std::string filter;
+};
+
+class Runner {
+  Options _options;
+  bool _first = true;
+
+public:
+  explicit Runner(Options options) : _options(std::move(options)) {
+    std::cout << "{\"benchmarks\": [";
+  }
+
+  ~Runner() { std::cout << "\n]}" << std::endl; }
+
+private:
+  struct Measurement {
+    size_t matches = 0;
+    size_t passes = 0;
+    double seconds = 0;
+    size_t allocated = 0;
+    size_t peakKiB = 0;
+  };
+
+  template <class Accept>
+  Measurement measure(const Workload &workload, Accept &accept) const {
+    Measurement result;
+    // One untimed pass to warm up caches and count the matches.
+    for (const auto &input : workload.inputs) {
+      result.matches += accept(input);
+    }
+
+    using clock = std::chrono::steady_clock;
+    const auto allocationsBefore = allocations.load();
+    const auto start = clock::now();
+    do {
+      size_t passMatches = 0;
+      for (const auto &input : workload.inputs) {
+        passMatches += accept(input);
+      }
+      // Keeps the compiler from dropping calls whose result is unused.
+      sink = passMatches;
+      ++result.passes;
+      result.seconds =
+          std::chrono::duration<double>(clock::now() - start).count();
+    } while (result.seconds < _options.minSeconds);
+    result.allocated = allocations.load() - allocationsBefore;
+    return result;
+  }
+
+  // Measures in a child process, so the peak memory is this engine's alone
+  // rather than the most any engine so far held, and whatever the engine
+  // leaves resident, like a deep stack, goes away with the child. Without
+  // `fork`, measures here and reports the peak as unknown.
+  template <class Accept>
+  Measurement measureIsolated(const Workload &workload, Accept &accept) {
+#if FSM_BENCHMARK_HAS_FORK
+    int fds[2];
+    if (pipe(fds) == 0) {
+      std::cout.flush();
+      const auto pid = fork();
+      if (pid == 0) {
+        close(fds[0]);
+        auto result = measure(workload, accept);
+        result.peakKiB = peakMemoryKiB();
+        const auto written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+      }
+      close(fds[1]);
+      Measurement result;
+      const auto received =
+          pid > 0 ? read(fds[0], &result, sizeof(result)) : 0;
+      close(fds[0]);
+      if (pid > 0) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (received == sizeof(result)) {
+          return result;
+        }
+      }
+    }
+#endif
+    return measure(workload, accept);
+  }
+
+public:
+  /// Times `accept` over every input of `workload` for at least the minimum
+  /// time, and prints one JSON object with the results.
+  template <class Accept>
+  void run(const std::string &engine, const Workload &workload,
+           Accept accept) {
+    const auto name = engine + "/" + workload.name;
+    if (name.find(_options.filter) == std::string::npos) {
+      return;
+    }
+    std::cerr << name << std::endl;
+
+    const auto m = measureIsolated(workload, accept);
+    const auto runs = double(m.passes * workload.inputs.size());
+    std::cout << (_first ? "\n" : ",\n") << "  {\"name\": \"" << name
+              << "\", \"engine\": \"" << engine << "\", \"workload\": \""
+              << workload.name << "\", \"inputs\": " << workload.inputs.size()
+              << ", \"bytes\": " << workload.bytes()
+              << ", \"matches\": " << m.matches << ", \"passes\": " << m.passes
+              << ", \"ns_per_match\": " << m.seconds * 1e9 / runs
+              << ", \"bytes_per_second\": "
+              << m.passes * workload.bytes() / m.seconds
+              << ", \"allocations_per_match\": " << m.allocated / runs
+              << ", \"peak_rss_kib\": " << m.peakKiB << "}";
+    _first = false;
+  }
+};
+
+int main(int argc, const char *argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--quick") {
+      options.minSeconds = 0;
+    } else if (arg == "--min-time" && i + 1 < argc) {
+      options.minSeconds = std::atof(argv[++i]);
+    } else if (arg == "--filter" && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--quick] [--min-time seconds] [--filter substring]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  Runner runner(options);
+  {
+    const auto M = kContainsEither0100or0111.toMachine();
+    const auto C = M.compile();
+    const JitMachine J(C);
+    for (const auto &workload : {randomStrings("binary-64", "01", 1000, 64),
+                                 randomStrings("binary-1M", "01", 1, 1 << 20)}) {
+      runner.run("Machine", workload,
+                 [&](std::string_view input) { return M.accept(input); });
+      runner.run("CompiledMachine", workload,
+                 [&](std::string_view input) { return C.accept(input); });
+      runner.run("JitMachine", workload,
+                 [&](std::string_view input) { return J.accept(input); });
+    }
+  }
+
+  {
+    const std::string pattern = "a*b.*c*a";
+    auto parser = regex::PatternParser(pattern);
+    const auto nfa = regex::NFA(parser);
+    regex::LazyDFA lazy(nfa);
+    regex::Solution solution;
+    const auto workload = randomStrings("abc-32", "abc", 1000, 32);
+    runner.run("regex::NFA", workload,
+               [&](std::string_view input) { return nfa.accept(input); });
+    runner.run("regex::LazyDFA", workload,
+               [&](std::string_view input) { return lazy.accept(input); });
+    runner.run("regex::Solution", workload, [&](const std::string &input) {
+      return solution.isMatch(input, pattern);
+    });
+  }
+
+  {
+    const auto pattern = starsPattern(20);
+    auto parser = regex::PatternParser(pattern);
+    const auto nfa = regex::NFA(parser);
+    regex::LazyDFA lazy(nfa);
+    regex::Solution solution;
+    const auto workload = unmatchedRuns(100, 200);
+    runner.run("regex::NFA", workload,
+               [&](std::string_view input) { return nfa.accept(input); });
+    runner.run("regex::LazyDFA", workload,
+               [&](std::string_view input) { return lazy.accept(input); });
+    runner.run("regex::Solution", workload, [&](const std::string &input) {
+      return solution.isMatch(input, pattern);
+    });
+  }
+
+  {
+    const auto A = makeZerosThenOnes();
+    const auto D = A.compileDeterministic();
+    const auto workload = nestedZerosOnes(20000);
+    runner.run("PDA::Automaton", workload,
+               [&](std::string_view input) { return A.accept(input); });
+    runner.run("PDA::Automaton::acceptIterative", workload,
+               [&](std::string_view input) {
+                 return A.acceptIterative(input);
+               });
+    runner.run("PDA::DeterministicAutomaton", workload,
+               [&](std::string_view input) { return D->accept(input); });
+  }
+  return 0;
+}
@@ -0,0 +1,345 @@
+//
+//  fsm-grep.cpp
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#include "FSM.h"
+#include "JitMachine.h"
+#include "MachineFile.h"
+#include "Search.h"
+#include "ThreadPool.h"
+#include "regex-determinize.h"
+#include "regex-matcher.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FSM_GREP_HAS_MMAP 1
+#else
+#define FSM_GREP_HAS_MMAP 0
+#endif
+
+static const char *const kUsage =
+    "usage: fsm-grep (-e pattern | -f machine-file) [-s] [-v] [-c] [-n]\n"
+    "                [-j threads] file...\n"
+    "\n"
+    "  -e pattern  a regex of literals, '.' and '*', as regex::Solution\n"
+    "  -f file     a machine written by MachineFile::write\n"
+    "  -s          select lines containing a match, not lines that match\n"
+    "  -v          select the lines that don't\n"
+    "  -c          print the number of selected lines instead of the lines\n"
+    "  -n          print line numbers\n"
+    "  -j threads  threads to scan with, all cores by default\n";
+
+// States a pattern may determinize to. The subset construction is
+// exponential in the worst case, and patterns come from the command line.
+static constexpr size_t kMaxPatternStates = 1 << 14;
+
+struct Options {
+  std::string pattern;
+  bool hasPattern = false;
+  std::string machinePath;
+  bool search = false;
+  bool invert = false;
+  bool countOnly = false;
+  bool lineNumbers = false;
+  size_t threads = 0;
+  std::vector<std::string> files;
+};
+
+// The bytes of a file, mapped read only when possible and read into memory
+// otherwise.
+class FileContents {
+  std::string_view _bytes;
+  void *_mapping = nullptr;
+  size_t _mappedSize = 0;
+  std::string _copy;
+
+public:
+  explicit FileContents(const std::string &path) {
+#if FSM_GREP_HAS_MMAP
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      struct stat info {};
+      if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+          info.st_size > 0) {
+        const auto size = static_cast<size_t>(info.st_size);
+        auto *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+          madvise(data, size, MADV_SEQUENTIAL);
+          _mapping = data;
+          _mappedSize = size;
+          _bytes = std::string_view(static_cast<const char *>(data), size);
+        }
+      }
+      close(fd);
+      if (_mapping) {
+        return;
+      }
+    }
+#endif
+    // Empty files, pipes and platforms without mmap.
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      throw std::runtime_error("cannot open " + path);
+    }
+    _copy.assign(std::istreambuf_iterator<char>(in), {});
+    _bytes = _copy;
+  }
+
+  FileContents(const FileContents &) = delete;
+  FileContents &operator=(const FileContents &) = delete;
+
+  ~FileContents() {
+#if FSM_GREP_HAS_MMAP
+    if (_mapping) {
+      munmap(_mapping, _mappedSize);
+    }
+#endif
+  }
+
+  std::string_view bytes() const noexcept { return _bytes; }
+};
+
+// Splits `text` in about `count` chunks that each end right after a newline,
+// or at the end of the text.
+static std::vector<std::string_view> splitAtLines(std::string_view text,
+                                                  size_t count) {
+  std::vector<std::string_view> chunks;
+  const auto target = std::max<size_t>(text.size() / count, 1);
+  size_t begin = 0;
+  while (begin < text.size()) {
+    auto end = std::min(text.size(), begin + target);
+    if (end < text.size()) {
+      const auto newline = text.find('\n', end - 1);
+      end = newline == std::string_view::npos ? text.size() : newline + 1;
+    }
+    chunks.push_back(text.substr(begin, end - begin));
+    begin = end;
+  }
+  return chunks;
+}
+
+// What one chunk found: its number of lines and, unless only counting, the
+// selected lines with their index in the chunk.
+struct ChunkResult {
+  size_t lines = 0;
+  size_t selected = 0;
+  std::vector<std::pair<size_t, std::string_view>> lineViews;
+};
+
+template <class Select>
+static ChunkResult scanChunk(std::string_view chunk, bool keepLines,
+                             const Select &select) {
+  ChunkResult result;
+  size_t begin = 0;
+  while (begin < chunk.size()) {
+    const auto *newline = static_cast<const char *>(
+        std::memchr(chunk.data() + begin, '\n', chunk.size() - begin));
+    const auto end =
+        newline ? static_cast<size_t>(newline - chunk.data()) : chunk.size();
+    const auto line = chunk.substr(begin, end - begin);
+    if (select(line)) {
+      ++result.selected;
+      if (keepLines) {
+        result.lineViews.push_back({result.lines, line});
+      }
+    }
+    ++result.lines;
+    begin = end + 1;
+  }
+  return result;
+}
+
+static const char *describe(MachineFile::Error error) {
+  switch (error) {
+  case MachineFile::Error::None:
+    return "no error";
+  case MachineFile::Error::CannotOpen:
+    return "cannot open it";
+  case MachineFile::Error::TooSmall:
+  case MachineFile::Error::BadMagic:
+    return "not a machine file";
+  case MachineFile::Error::Misaligned:
+    return "misaligned";
+  case MachineFile::Error::OtherEndianness:
+    return "written with the other byte order";
+  case MachineFile::Error::UnsupportedVersion:
+    return "unsupported version";
+  case MachineFile::Error::Truncated:
+    return "truncated";
+  case MachineFile::Error::BadChecksum:
+  case MachineFile::Error::BadState:
+    return "damaged";
+  }
+  return "unknown error";
+}
+
+static std::optional<CompiledMachine> loadMachine(const Options &options) {
+  if (!options.machinePath.empty()) {
+    MachineFile::Error error;
+    auto machine = MachineFile::load(options.machinePath, &error);
+    if (!machine) {
+      std::cerr << "fsm-grep: cannot load " << options.machinePath << ": "
+                << describe(error) << std::endl;
+    }
+    return machine;
+  }
+  auto parser = regex::PatternParser(options.pattern);
+  const auto nfa = regex::NFA(parser);
+  const auto machine = regex::determinize(nfa, kMaxPatternStates);
+  if (!machine) {
+    std::cerr << "fsm-grep: pattern too complex" << std::endl;
+    return std::nullopt;
+  }
+  return machine->compile();
+}
+
+static std::optional<Options> parseOptions(int argc, const char *argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "-e" && i + 1 < argc) {
+      options.pattern = argv[++i];
+      options.hasPattern = true;
+    } else if (arg == "-f" && i + 1 < argc) {
+      options.machinePath = argv[++i];
+    } else if (arg == "-j" && i + 1 < argc) {
+      options.threads = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "-s") {
+      options.search = true;
+    } else if (arg == "-v") {
+      options.invert = true;
+    } else if (arg == "-c") {
+      options.countOnly = true;
+    } else if (arg == "-n") {
+      options.lineNumbers = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      return std::nullopt;
+    } else {
+      options.files.emplace_back(arg);
+    }
+  }
+  const auto sources = options.hasPattern + !options.machinePath.empty();
+  if (sources != 1 || options.files.empty()) {
+    return std::nullopt;
+  }
+  if (options.threads == 0) {
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  return options;
+}
+
+int main(int argc, const char *argv[]) {
+  const auto options = parseOptions(argc, argv);
+  if (!options) {
+    std::cerr << kUsage;
+    return 2;
+  }
+  auto machine = loadMachine(*options);
+  if (!machine) {
+    return 2;
+  }
+
+  // Whole lines run through the JIT, which interprets where it can't; a
+  // substring search runs the searcher over the same machine.
+  const JitMachine jit(std::move(*machine));
+  std::optional<MachineSearcher> searcher;
+  if (options->search) {
+    searcher.emplace(jit.machine());
+  }
+  const auto invert = options->invert;
+  auto select = [&](std::string_view line) {
+    const auto matched =
+        searcher ? searcher->contains(line) : jit.accept(line);
+    return matched != invert;
+  };
+
+  WorkStealingPool pool(options->threads);
+  // A few chunks per thread balances uneven lines, and a minimum size keeps
+  // small files from paying for many tasks.
+  constexpr size_t kMinChunkSize = 1 << 16;
+  const auto showNames = options->files.size() > 1;
+  size_t totalBytes = 0;
+  size_t totalLines = 0;
+  size_t totalSelected = 0;
+  bool failed = false;
+  const auto start = std::chrono::steady_clock::now();
+
+  std::ios::sync_with_stdio(false);
+  for (const auto &path : options->files) {
+    std::optional<FileContents> file;
+    try {
+      file.emplace(path);
+    } catch (const std::exception &error) {
+      std::cerr << "fsm-grep: " << error.what() << std::endl;
+      failed = true;
+      continue;
+    }
+    const auto text = file->bytes();
+    const auto chunkCount = std::max<size_t>(
+        1, std::min(options->threads * 4, text.size() / kMinChunkSize));
+    const auto chunks = splitAtLines(text, chunkCount);
+
+    std::vector<ChunkResult> results(chunks.size());
+    pool.parallelFor(chunks.size(), [&](size_t c) {
+      results[c] = scanChunk(chunks[c], !options->countOnly, select);
+    });
+
+    // Lines come out in file order, numbered across chunks.
+    size_t selected = 0;
+    size_t firstLine = 1;
+    for (const auto &result : results) {
+      selected += result.selected;
+      for (const auto &[index, line] : result.lineViews) {
+        if (showNames) {
+          std::cout << path << ':';
+        }
+        if (options->lineNumbers) {
+          std::cout << firstLine + index << ':';
+        }
+        std::cout.write(line.data(), line.size());
+        std::cout << '\n';
+      }
+      firstLine += result.lines;
+    }
+    if (options->countOnly) {
+      if (showNames) {
+        std::cout << path << ':';
+      }
+      std::cout << selected << '\n';
+    }
+    totalBytes += text.size();
+    totalLines += firstLine - 1;
+    totalSelected += selected;
+  }
+  std::cout.flush();
+
+  const auto seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  std::cerr << "fsm-grep: " << totalSelected << " of " << totalLines
+            << " lines, " << totalBytes << " bytes in " << seconds * 1e3
+            << " ms, " << (seconds > 0 ? totalBytes / seconds / 1e6 : 0)
+            << " MB/s on " << options->threads << " threads"
+            << (jit.isNative() ? "" : ", interpreted") << std::endl;
+  return failed ? 2 : totalSelected > 0 ? 0 : 1;
+}
@@ -5,10 +5,26 @@
 //  Created by Luciano Almeida on 21/04/22.
 //
 
+#include "BatchMatcher.h"
+#include "ExampleMachines.h"
 #include "FSM.h"
+#include "JitMachine.h"
+#include "MachineFile.h"
+#include "MultiStream.h"
 #include "PDA.h"
+#include "ParallelBuilder.h"
+#include "PatternSet.h"
+#include "Search.h"
+#include "SpeculativeMatcher.h"
+#include "StaticMachine.h"
+#include "regex-lazy-dfa.h"
 #include "regex-matcher.h"
+#include <cstdio>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
 
 // 01, 10, 001, 110 ... 111110000, 00001111
 // A finite state machine that starts in zeros and ends in ones
@@ -20,7 +36,7 @@ static std::unique_ptr<Machine> make01s10sMachine() {
   auto machine = std::make_unique<Machine>(q, /*startState=*/0, finalStates);
   machine->addTransition(0, '0', 1);
   machine->addTransition(0, '1', 2);
-  
+
   machine->addTransition(1, '0', 1);
   machine->addTransition(1, '1', 3);
 
@@ -29,10 +45,10 @@ static std::unique_ptr<Machine> make01s10sMachine() {
 
   machine->addTransition(3, '0', 5);
   machine->addTransition(3, '1', 3);
-  
+
   machine->addTransition(4, '0', 4);
   machine->addTransition(4, '1', 5);
-  
+
   // Dead state
   machine->addTransition(5, '0', 5);
   machine->addTransition(5, '1', 5);
@@ -52,7 +68,7 @@ static std::unique_ptr<Machine> makeEndInZerosMachine() {
 
   machine->addTransition(1, '0', 1);
   machine->addTransition(1, '1', 0);
-  
+
   return machine;
 }
 
@@ -148,7 +164,125 @@ inline void assertNotAccepted(const StateMachine &M, std::string_view str) {
   assert(!result);
 }
 
-int main(int argc, const char * argv[]) {
+// Calls `fn` with every string of at most `maxLength` symbols of `alphabet`.
+template <class Fn>
+static void forEachString(std::string_view alphabet, size_t maxLength, Fn fn) {
+  std::string str;
+  std::vector<size_t> digits;
+  while (true) {
+    fn(std::string_view(str));
+    // Advance like an odometer, growing the string when all digits wrap.
+    size_t i = 0;
+    for (; i < digits.size(); ++i) {
+      if (++digits[i] < alphabet.size()) {
+        break;
+      }
+      digits[i] = 0;
+    }
+    if (i == digits.size()) {
+      if (digits.size() == maxLength) {
+        return;
+      }
+      digits.push_back(0);
+    }
+    str.resize(digits.size());
+    for (size_t j = 0; j < digits.size(); ++j) {
+      str[j] = alphabet[digits[j]];
+    }
+  }
+}
+
+// Asserts that the compiled form of a machine agrees with it on every short
+// string over its alphabet plus a symbol it has no transition for.
+static void assertCompiledAgrees(const Machine &M, std::string_view alphabet) {
+  const auto C = M.compile();
+  forEachString(alphabet, 8, [&](std::string_view str) {
+    assert(C.accept(str) == M.accept(str) && "Compiled machine disagrees");
+  });
+}
+
+// Asserts that feeding a cursor any string split in two chunks, or byte by
+// byte, gives the same verdict as accepting it in one go.
+static void assertCursorAgrees(const Machine &M, std::string_view alphabet) {
+  forEachString(alphabet, 6, [&](std::string_view str) {
+    const auto expected = M.accept(str);
+    for (size_t split = 0; split <= str.size(); ++split) {
+      auto cursor = M.cursor();
+      if (cursor.feed(str.substr(0, split))) {
+        cursor.feed(str.substr(split));
+      }
+      assert(cursor.finish() == expected && "Cursor disagrees");
+    }
+
+    auto cursor = M.cursor();
+    for (size_t i = 0; i < str.size() && !cursor.isDone(); ++i) {
+      cursor.feed(str.substr(i, 1));
+    }
+    assert(cursor.finish() == expected && "Cursor disagrees");
+  });
+}
+
+// Asserts that minimizing a machine keeps its language, reaches the expected
+// number of states and can't shrink any further.
+static void assertMinimizes(const Machine &M, std::string_view alphabet,
+                            size_t expectedStates) {
+  Machine::MinimizationStats stats;
+  const auto minimal = M.minimize(&stats);
+  std::cout << "minimized " << stats.statesBefore << " -> "
+            << stats.statesAfter << " states, " << stats.transitionsBefore
+            << " -> " << stats.transitionsAfter << " transitions"
+            << std::endl;
+  assert(stats.statesBefore == M.stateCount());
+  assert(stats.statesAfter == expectedStates);
+  assert(minimal.minimize().stateCount() == expectedStates);
+  forEachString(alphabet, 8, [&](std::string_view str) {
+    assert(minimal.accept(str) == M.accept(str) && "Minimized disagrees");
+  });
+}
+
+// Asserts that a searcher finds the same matches as trying every begin and
+// then every end in order, with `isMatch` deciding on each substring.
+template <class Searcher, class IsMatch>
+static void assertSearchAgrees(const Searcher &searcher, std::string_view text,
+                               IsMatch isMatch) {
+  std::vector<Match> expected;
+  for (size_t begin = 0; begin <= text.size();) {
+    bool found = false;
+    for (size_t end = begin; end <= text.size() && !found; ++end) {
+      if (isMatch(text.substr(begin, end - begin))) {
+        expected.push_back({begin, end});
+        begin = end > begin ? end : begin + 1;
+        found = true;
+      }
+    }
+    if (!found) {
+      ++begin;
+    }
+  }
+  assert(searcher.findAll(text) == expected && "Searcher disagrees");
+}
+
+// Asserts that two machines are the same, numbering included.
+static void assertSameMachine(const CompiledMachine &L,
+                              const CompiledMachine &R) {
+  assert(L.stateCount() == R.stateCount() && "Machines differ");
+  assert(L.classCount() == R.classCount() && "Machines differ");
+  assert(L.startState() == R.startState() && "Machines differ");
+  assert(std::equal(L.classes(),
+                    L.classes() + CompiledMachine::kAlphabetSize,
+                    R.classes()) &&
+         "Machines differ");
+  assert(std::equal(L.table(),
+                    L.table() + L.stateCount() * L.classCount(),
+                    R.table()) &&
+         "Machines differ");
+}
+
+static void assertSameMachine(const Machine &lhs, const Machine &rhs) {
+  assertSameMachine(lhs.compile(), rhs.compile());
+}
+
+int main() {
   {
     auto M = make01s10sMachine();
     assertAccepted(*M, "001");
@@ -162,6 +296,16 @@ int main(int argc, const char * argv[]) {
     assertAccepted(*M, "10");
     assertAccepted(*M, "111110000");
     assertAccepted(*M, "000011111");
+    assertCompiledAgrees(*M, "01x");
+    assertCursorAgrees(*M, "01x");
+    assertMinimizes(*M, "01x", 5);
+
+    // "101" reaches the dead state 5, so nothing fed after it is read.
+    auto cursor = M->cursor();
+    assert(!cursor.feed("101"));
+    assert(cursor.isDead() && cursor.consumed() == 3);
+    assert(!cursor.feed("0000"));
+    assert(!cursor.finish());
   }
 
   {
@@ -176,6 +320,9 @@ int main(int argc, const char * argv[]) {
     assertAccepted(*M, "0000");
     assertNotAccepted(*M, "00001");
     assertNotAccepted(*M, "1111");
+    assertCompiledAgrees(*M, "01x");
+    assertCursorAgrees(*M, "01x");
+    assertMinimizes(*M, "01x", 2);
   }
 
   {
@@ -192,6 +339,9 @@ int main(int argc, const char * argv[]) {
     assertAccepted(*M, "00110111");
     assertAccepted(*M, "0101001011");
     assertAccepted(*M, "010101010111010101");
+    assertCompiledAgrees(*M, "01x");
+    assertCursorAgrees(*M, "01x");
+    assertMinimizes(*M, "01x", 6);
   }
 
   {
@@ -199,6 +349,307 @@ int main(int argc, const char * argv[]) {
     auto M = makeContainsAbc();
     assertNotAccepted(*M, "aabac");
     assertAccepted(*M, "aacbabca");
+    assertCompiledAgrees(*M, "abcx");
+    assertCursorAgrees(*M, "abcx");
+    assertMinimizes(*M, "abcx", 4);
+  }
+
+  {
+    std::cout << "Minimization" << std::endl;
+    // Ends in zeros again, with redundant states and an unreachable one.
+    Machine M({0, 1, 2, 3, 9}, /*startState=*/0, /*finalStates=*/{1, 3});
+    M.addTransition(0, '0', 1);
+    M.addTransition(0, '1', 2);
+    M.addTransition(1, '0', 3);
+    M.addTransition(1, '1', 2);
+    M.addTransition(2, '0', 1);
+    M.addTransition(2, '1', 0);
+    M.addTransition(3, '0', 3);
+    M.addTransition(3, '1', 0);
+    M.addTransition(9, '0', 0);
+    assertMinimizes(M, "01x", 2);
+  }
+
+  {
+    std::cout << "Batch matching" << std::endl;
+    auto M = makeContainsEither0100or0111();
+    std::vector<std::string> records;
+    forEachString("01", 12, [&](std::string_view str) {
+      records.emplace_back(str);
+    });
+    std::vector<std::string_view> inputs(records.begin(), records.end());
+
+    BatchMatcher matcher(/*threadCount=*/4, /*chunkSize=*/1000);
+    const auto results = matcher.acceptAll(*M, inputs);
+    const auto compiledResults = matcher.acceptAll(M->compile(), inputs);
+    size_t accepted = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      assert(results.test(i) == M->accept(inputs[i]));
+      assert(compiledResults.test(i) == results.test(i));
+      accepted += results.test(i);
+    }
+    assert(results.count() == accepted);
+    std::cout << accepted << " of " << inputs.size() << std::endl;
+
+    // Shuffle lengths around so lanes finish at different steps.
+    std::reverse(inputs.begin() + inputs.size() / 2, inputs.end());
+    const auto C = M->compile();
+    std::vector<InterleavedMatcher::Kernel> kernels{
+        InterleavedMatcher::Kernel::Scalar};
+    if (InterleavedMatcher::canGather(C)) {
+      kernels.push_back(InterleavedMatcher::Kernel::Gather);
+    }
+    for (const auto kernel : kernels) {
+      ResultBitmap interleaved;
+      InterleavedMatcher::acceptAll(C, inputs.data(), inputs.size(),
+                                    interleaved, kernel);
+      for (size_t i = 0; i < inputs.size(); ++i) {
+        assert(interleaved.test(i) == C.accept(inputs[i]));
+      }
+    }
+  }
+
+  {
+    std::cout << "Speculative chunked matching" << std::endl;
+    WorkStealingPool pool(4);
+    const auto endInZeros = makeEndInZerosMachine()->compile();
+    const auto either = makeContainsEither0100or0111()->compile();
+    const auto zerosThenOnes = make01s10sMachine()->compile();
+
+    std::string input;
+    for (size_t i = 0; i < 100000; ++i) {
+      input += "0110"[(i * 7919) % 4];
+    }
+    const auto check = [&](const CompiledMachine &C, std::string_view str) {
+      const auto result = SpeculativeMatcher::accept(C, str, pool, 1000);
+      assert(result == C.accept(str));
+      return result;
+    };
+    assert(check(endInZeros, input + "0"));
+    assert(!check(endInZeros, input + "1"));
+    assert(!check(either, input));
+    assert(check(either, input + "0100" + input));
+    assert(!check(either, std::string(50000, '1') + "x"));
+    assert(check(zerosThenOnes, std::string(50000, '0') + "1"));
+    assert(!check(zerosThenOnes, std::string(50000, '0') + "10"));
+
+    // Small chunks over short inputs, where rounding the chunk size up
+    // leaves fewer chunks than asked for.
+    for (size_t minChunkSize = 1; minChunkSize <= 4; ++minChunkSize) {
+      for (size_t length = 0; length <= 40; ++length) {
+        for (const auto last : {'0', '1'}) {
+          const auto str = std::string(length, '0') + last;
+          assert(SpeculativeMatcher::accept(endInZeros, str, pool,
+                                            minChunkSize) ==
+                 endInZeros.accept(str));
+        }
+        const auto prefix = std::string_view(input).substr(0, length);
+        assert(SpeculativeMatcher::accept(either, prefix, pool,
+                                          minChunkSize) ==
+               either.accept(prefix));
+      }
+    }
+  }
+
+  {
+    std::cout << "Search" << std::endl;
+    const auto abc = makeContainsAbc()->compile();
+    // The searcher keeps its own view of a temporary machine.
+    const MachineSearcher machineSearcher(makeContainsAbc()->compile());
+    assert(!machineSearcher.findFirst("xxaabxbc"));
+    assert((*machineSearcher.findFirst("xxaabcyy") == Match{2, 6}));
+    assert(!machineSearcher.contains("xxaabxbc"));
+    assert(machineSearcher.contains("xxaabcyy"));
+    forEachString("abx", 7, [&](std::string_view str) {
+      assertSearchAgrees(machineSearcher, str, [&](std::string_view sub) {
+        return abc.accept(sub);
+      });
+    });
+    for (const auto &machine :
+         {abc, makeEndInZerosMachine()->compile(),
+          makeContainsEither0100or0111()->compile()}) {
+      const MachineSearcher searcher(machine);
+      forEachString("01abc", 6, [&](std::string_view str) {
+        assert(searcher.contains(str) == searcher.findFirst(str).has_value());
+      });
+    }
+
+    regex::Solution solution;
+    const auto patterns = {"ab*c", "a*b", ".*c", "c.a", "a*", "xb"};
+    for (const auto pattern : patterns) {
+      regex::Searcher searcher(pattern);
+      forEachString("abcx", 6, [&](std::string_view str) {
+        assertSearchAgrees(searcher, str, [&](std::string_view sub) {
+          return solution.isMatch(std::string(sub), pattern);
+        });
+      });
+    }
+
+    // Long enough for the vectorised scan, with matches near both ends.
+    std::string haystack(1000, 'x');
+    haystack.replace(3, 3, "abc");
+    haystack.replace(990, 4, "abbc");
+    const auto matches = regex::Searcher("ab*c").findAll(haystack);
+    assert((matches == std::vector<Match>{{3, 6}, {990, 994}}));
+    assert(!regex::Searcher("ab*d").findFirst(haystack));
+  }
+
+  {
+    std::cout << "Pattern sets" << std::endl;
+    std::vector<CompiledMachine> machines{
+        make01s10sMachine()->compile(), makeEndInZerosMachine()->compile(),
+        makeContainsEither0100or0111()->compile(),
+        makeContainsAbc()->compile()};
+    const std::vector<std::string> patterns{"a*b", ".*ab.*", "a*b*.a*",
+                                            "ab*a", "..a*b*", "0*1"};
+    for (const auto &pattern : patterns) {
+      auto parser = regex::PatternParser(pattern);
+      auto determinized = regex::determinize(regex::NFA(parser));
+      assert(determinized.has_value());
+      machines.push_back(determinized->compile());
+    }
+
+    const PatternSet combined(machines);
+    // Small enough that the machines have to be split up.
+    const PatternSet partitioned(machines, PatternSet::Limits{16});
+    const auto fromPatterns = PatternSet::fromPatterns(patterns);
+    assert(fromPatterns.has_value());
+    // Each '.' after the 'a' doubles the subsets to track.
+    PatternSet::Limits small;
+    small.maxPatternStates = 256;
+    assert(!PatternSet::fromPatterns({"a*b", ".*a..........b"}, small));
+    assert(combined.groupCount() == 1);
+    assert(partitioned.groupCount() > 1);
+    std::cout << combined.stateCount() << " combined states, "
+              << partitioned.groupCount() << " groups of "
+              << partitioned.stateCount() << " when partitioned" << std::endl;
+
+    forEachString("01abc", 6, [&](std::string_view str) {
+      std::vector<size_t> expected;
+      for (size_t i = 0; i < machines.size(); ++i) {
+        if (machines[i].accept(str)) {
+          expected.push_back(i);
+        }
+      }
+      assert(combined.matchAll(str) == expected);
+      assert(partitioned.matchAll(str) == expected);
+
+      const auto fromPatternsIds = fromPatterns->matchAll(str);
+      for (size_t i = 0; i < patterns.size(); ++i) {
+        const auto found = std::find(fromPatternsIds.begin(),
+                                     fromPatternsIds.end(),
+                                     i) != fromPatternsIds.end();
+        assert(found == regex::Solution().isMatch(std::string(str),
+                                                  patterns[i]));
+      }
+    });
+  }
+
+  {
+    std::cout << "Parallel building" << std::endl;
+    WorkStealingPool single(1);
+    WorkStealingPool pool(4);
+    const auto patterns = {"a*b", ".*ab.*", "a*b*.a*", "..a*b*",
+                           ".*a.b..c*.", ".*a.......b.*"};
+    for (const auto pattern : patterns) {
+      auto parser = regex::PatternParser(pattern);
+      const auto nfa = regex::NFA(parser);
+      const auto sequential = regex::determinize(nfa);
+      for (auto *threads : {&single, &pool}) {
+        const auto parallel = ParallelBuilder::determinize(nfa, *threads);
+        assertSameMachine(*parallel, *sequential);
+        assertSameMachine(ParallelBuilder::minimize(*parallel, *threads),
+                          sequential->minimize());
+      }
+      assert(!ParallelBuilder::determinize(nfa, pool, 2) ==
+             !regex::determinize(nfa, 2));
+      std::cout << pattern << ": " << sequential->stateCount() << " -> "
+                << sequential->minimize().stateCount() << " states"
+                << std::endl;
+    }
+    for (const auto &M :
+         {make01s10sMachine(), makeEndInZerosMachine(),
+          makeContainsEither0100or0111(), makeContainsAbc()}) {
+      assertSameMachine(ParallelBuilder::minimize(*M, pool), M->minimize());
+    }
+  }
+
+  {
+    std::cout << "Regex" << std::endl;
+    regex::Solution solution;
+    assert(!solution.isMatch("aa", "a"));
+    assert(solution.isMatch("aa", "a*"));
+    assert(solution.isMatch("ab", ".*"));
+    assert(solution.isMatch("aab", "c*a*b"));
+    assert(!solution.isMatch("mississippi", "mis*is*p*."));
+
+    // Longer than a single word of tokens.
+    std::string longPattern, longInput;
+    for (size_t i = 0; i < 40; ++i) {
+      longPattern += "a*b.";
+      longInput += i % 2 ? "bc" : "aabx";
+    }
+    assert(solution.isMatch(longInput, longPattern));
+    assert(!solution.isMatch(longInput + "a", longPattern));
+
+    {
+      // Evicts least recently used patterns and counts hits and misses.
+      regex::PatternCache cache(/*capacity=*/2);
+      assert(cache.get("a*b")->accept("aab"));
+      assert(cache.get(".*c")->accept("abc"));
+      assert(cache.get("a*b")->accept("b"));
+      assert(!cache.get("ab")->accept("abc"));
+      assert(!cache.get(".*c")->accept("ab"));
+      const auto stats = cache.getStats();
+      assert(stats.hits == 1 && stats.misses == 4 && stats.evictions == 2);
+      assert(cache.size() == 2);
+
+      const auto compiled = solution.compile("a*b*c");
+      WorkStealingPool pool(4);
+      std::atomic<size_t> matches{0};
+      pool.parallelFor(64, [&](size_t i) {
+        const auto input = std::string(i % 8, 'a') + "bc";
+        matches += compiled->accept(input);
+        matches += solution.isMatch(input, i % 2 ? "a*bc" : ".*c");
+      });
+      assert(matches == 128);
+    }
+
+    const auto patterns = {"a*b", ".*ab.*", "a*b*.a*", "ab*a", "..a*b*"};
+    for (const auto pattern : patterns) {
+      auto parser = regex::PatternParser(pattern);
+      auto nfa = regex::NFA(parser);
+      regex::LazyDFA lazy(nfa);
+      // Small enough to force flushes halfway through matches.
+      regex::LazyDFA flushing(nfa, /*memoryBudget=*/3000);
+
+      std::vector<regex::Token> tokens;
+      auto tokenizer = regex::PatternParser(pattern);
+      while (tokenizer.canGet()) {
+        tokens.push_back(tokenizer.next());
+      }
+      const regex::ShiftAndMatcher shiftAnd(tokens);
+      const regex::WideShiftAndMatcher wideShiftAnd(tokens);
+
+      forEachString("abc", 7, [&](std::string_view str) {
+        const auto expected = nfa.accept(str);
+        assert(lazy.accept(str) == expected);
+        assert(flushing.accept(str) == expected);
+        assert(shiftAnd.accept(str) == expected);
+        assert(wideShiftAnd.accept(str) == expected);
+      });
+      assert(lazy.getStats().flushes == 0);
+
+      // Scratch memory was sized by the longest input and is reused since.
+      const auto arena = regex::ScratchArena::local().getStats();
+      assert(arena.highWaterBytes > 0);
+      nfa.accept("abcabca");
+      assert(regex::ScratchArena::local().getStats().growths ==
+             arena.growths);
+      assert(flushing.getStats().flushes > 0);
+      std::cout << pattern << ": " << lazy.getStats().states << " states"
+                << std::endl;
+    }
   }
 
   // PDA
@@ -221,6 +672,435 @@ int main(int argc, const char * argv[]) {
     assertAccepted(*A, "0011");
     assertAccepted(*A, "000111");
     assertAccepted(*A, "00001111");
+
+    // The same language without backtracking.
+    const auto D = A->compileDeterministic();
+    assert(D.has_value());
+    forEachString("01", 10, [&](std::string_view str) {
+      assert(D->accept(str) == A->accept(str));
+    });
+    assert(D->accept(std::string(100000, '0') + std::string(100000, '1')));
+    assert(!D->accept(std::string(100000, '0') + std::string(99999, '1')));
+
+    // Deeper than the native stack would allow a recursive search to go.
+    const auto deep = std::string(100000, '0') + std::string(100000, '1');
+    assert(A->acceptIterative(deep));
+    assert(!A->acceptIterative(deep + "1"));
+    forEachString("01", 8, [&](std::string_view str) {
+      assert(A->acceptIterative(str) == A->accept(str));
+    });
+
+    // Rejects instead of growing the stack past the limit.
+    const PDA::Limits limits{/*maxStackDepth=*/11};
+    assert(A->acceptIterative(std::string(10, '0') + std::string(10, '1'),
+                              limits));
+    assert(!A->acceptIterative(std::string(11, '0') + std::string(11, '1'),
+                               limits));
+    assert(D->accept(std::string(10, '0') + std::string(10, '1'), limits));
+    assert(!D->accept(std::string(11, '0') + std::string(11, '1'), limits));
+  }
+
+  {
+    // Balanced brackets of two kinds, deterministic on the top of stack.
+    const auto start = PDA::State(0);
+    const auto open = PDA::State(1);
+    const auto done = PDA::State(2);
+    const auto e = PDA::Symbol::epsilon();
+    PDA::Automaton brackets(start, {start, open, done}, {done});
+    brackets.addTransition(start, open, e, e, {'$'});
+    brackets.addTransition(open, open, {'('}, e, {'('});
+    brackets.addTransition(open, open, {'['}, e, {'['});
+    brackets.addTransition(open, open, {')'}, {'('}, e);
+    brackets.addTransition(open, open, {']'}, {'['}, e);
+    brackets.addTransition(open, done, e, {'$'}, e);
+    const auto D = brackets.compileDeterministic();
+    assert(D.has_value());
+    assert(D->accept("([()[]])()"));
+    assert(!D->accept("([)]"));
+    assert(!D->accept("(()"));
+    forEachString("()[]", 7, [&](std::string_view str) {
+      const auto expected = brackets.accept(str);
+      assert(D->accept(str) == expected);
+      for (size_t split = 0; split <= str.size(); ++split) {
+        auto session = D->session();
+        if (session.feed(str.substr(0, split))) {
+          session.feed(str.substr(split));
+        }
+        assert(session.finish() == expected);
+      }
+    });
+
+    // Reports where rejection became certain, without the rest of the input.
+    auto session = D->session();
+    assert(session.feed("(["));
+    assert(session.feed("()]"));
+    assert(!session.feed(")]("));
+    assert(session.rejectionOffset() == 6);
+    assert(!session.finish());
+    session.reset();
+    assert(session.feed("(()"));
+    assert(!session.rejectionOffset());
+    assert(!session.finish());
+    assert(session.rejectionOffset() == 3);
+
+    // Both epsilon moves can apply with anything on the stack.
+    PDA::Automaton ambiguous(start, {start, 1, 2}, {1, 2});
+    ambiguous.addTransition(start, 1, e, e, e);
+    ambiguous.addTransition(start, 2, e, e, e);
+    assert(!ambiguous.compileDeterministic().has_value());
+
+    // Pushes forever on an epsilon loop, which backtracking never returns
+    // from.
+    PDA::Automaton looping(start, {start, 1}, {1});
+    looping.addTransition(start, start, e, e, {'x'});
+    looping.addTransition(start, start, {'a'}, {'x'}, e);
+    looping.addTransition(start, 1, {'b'}, e, e);
+    assert(looping.accept("aaab"));
+    assert(!looping.accept("aaa"));
+    assert(!looping.accept("aba"));
+    assert(looping.acceptIterative("aaab", PDA::Limits{4}));
+    assert(!looping.acceptIterative("aaa", PDA::Limits{4}));
+
+    // Two ways to read every 'a', so 2^n runs for backtracking to try.
+    PDA::Automaton guessing(start, {start, 1}, {1});
+    guessing.addTransition(start, start, {'a'}, e, {'x'});
+    guessing.addTransition(start, start, {'a'}, e, {'y'});
+    guessing.addTransition(start, 1, {'b'}, {'y'}, e);
+    assert(!guessing.accept(std::string(200, 'a') + "c"));
+    assert(guessing.accept(std::string(200, 'a') + "b"));
+  }
+
+  // Probes
+  {
+    const auto M = make01s10sMachine();
+    CountingProbe probe;
+    assert(M->accept("0011", probe));
+    assert(probe.totals().visits == 5);
+    assert(probe.totals().transitions == 4);
+    assert(probe.forState(1).transitions == 2);
+    assert(probe.totals().deadExits == 0);
+    // Gives up in the dead state without reading the rest.
+    assert(!M->accept("010000", probe));
+    assert(probe.forState(5).deadExits == 1);
+    assert(probe.forState(5).transitions == 0);
+    // A missing transition rejects, which isn't a dead state.
+    assert(!M->accept("0x", probe));
+    assert(probe.forState(1).rejects == 1);
+    assert(probe.forState(1).deadExits == 0);
+    assert(probe.totals().deadExits == 1);
+
+    probe.reset();
+    assert(probe.totals().visits == 0);
+    auto parser = regex::PatternParser("a*a*a*b");
+    const auto nfa = regex::NFA(parser);
+    assert(!nfa.accept("aaaaaaaa", probe));
+    assert(probe.totals().backtracks > 0);
+    assert(probe.totals().memoHits > 0);
+
+    const auto A = makeStartWithZerosAndEndOnesWithSameCount();
+    const auto D = A->compileDeterministic();
+    const auto input = std::string(50, '0') + std::string(50, '1');
+    for (size_t engine = 0; engine < 3; ++engine) {
+      probe.reset();
+      const auto accepted = engine == 0   ? A->accept(input, probe)
+                            : engine == 1 ? A->acceptIterative(input, probe)
+                                          : D->accept(input, probe);
+      assert(accepted);
+      // The '$' marker and fifty zeros.
+      assert(engine == 0 || probe.maxStackDepth() == 51);
+      assert(probe.forState(1).visits > 0);
+      assert(probe.forState(3).visits > 0);
+    }
+    // One move per byte, plus the three epsilon moves.
+    assert(probe.totals().transitions == input.size() + 3);
+    assert(probe.totals().backtracks == 0);
+    probe.reset();
+    assert(!D->accept("001", probe) && probe.totals().rejects == 1);
+    assert(probe.totals().deadExits == 0);
+    probe.reset();
+    assert(D->accept(input, probe));
+
+    std::ostringstream json;
+    probe.dumpJson(json);
+    assert(json.str().find("\"maxStackDepth\": 51") != std::string::npos);
+    assert(json.str().find("{\"state\": 0, \"visits\": 1,") !=
+           std::string::npos);
+    std::cout << json.str() << std::endl;
+  }
+
+  // Static machines
+  {
+    static_assert(k01s10s.accept("0011") && !k01s10s.accept("0110"));
+    static_assert(kContainsAbc.accept("bcabca") && !kContainsAbc.accept("ab"));
+    static_assert(!kEndInZeros.accept("0x0"));
+    // A byte per entry, so the whole table is two cache lines at most.
+    static_assert(sizeof(StaticMachine<7, 2>::state_id) == 1);
+    static_assert(kContainsAbc.isContiguous());
+
+    const auto M01s10s = make01s10sMachine();
+    const auto endInZeros = makeEndInZerosMachine();
+    const auto either = makeContainsEither0100or0111();
+    const auto abc = makeContainsAbc();
+    forEachString("01x", 8, [&](std::string_view str) {
+      const auto expected = M01s10s->accept(str);
+      assert(k01s10s.accept(str) == expected);
+      assert(staticAccept<k01s10s>(str) == expected);
+      assert(staticAccept<kEndInZeros>(str) == endInZeros->accept(str));
+      assert(staticAccept<kContainsEither0100or0111>(str) ==
+             either->accept(str));
+    });
+    forEachString("abcd", 7, [&](std::string_view str) {
+      assert(staticAccept<kContainsAbc>(str) == abc->accept(str));
+    });
+    // `toMachine` gives the machines the fixtures build by hand, whose
+    // states are numbered from 1 for "contains abc".
+    assertSameMachine(k01s10s.toMachine(), *M01s10s);
+    assertSameMachine(kEndInZeros.toMachine(), *endInZeros);
+    assertSameMachine(kContainsEither0100or0111.toMachine(), *either);
+    assertSameMachine(kContainsAbc.toMachine(), *abc);
+
+    // An alphabet that isn't a range of bytes goes through a lookup table.
+    static constexpr auto evenVowels = [] {
+      StaticMachine<2, 5> machine("uoiea", /*startState=*/0,
+                                  /*finalStates=*/{0});
+      for (const auto ch : std::string_view("aeiou")) {
+        machine.addTransition(0, ch, 1);
+        machine.addTransition(1, ch, 0);
+      }
+      return machine;
+    }();
+    static_assert(!evenVowels.isContiguous());
+    assert(staticAccept<evenVowels>("aeio"));
+    assert(!staticAccept<evenVowels>("aei"));
+    assert(!staticAccept<evenVowels>("ab"));
+
+    // Mistakes are caught at compile time, and `staticAccept` refuses them.
+    using Error = StaticMachine<2, 2>::Error;
+    static_assert([] {
+      StaticMachine<2, 2> machine("01", 0, {1});
+      machine.addTransition(0, '0', 1);
+      machine.addTransition(0, '0', 0);
+      return machine.error();
+    }() == Error::ConflictingTransition);
+    static_assert([] {
+      StaticMachine<2, 2> machine("01", 0, {1});
+      machine.addTransition(0, '2', 1);
+      return machine.error();
+    }() == Error::SymbolNotInAlphabet);
+    static_assert([] {
+      StaticMachine<2, 2> machine("01", 0, {2});
+      machine.addTransition(0, '0', 1);
+      return machine.error();
+    }() == Error::FinalStateOutOfRange);
+    static_assert(StaticMachine<2, 2>("00", 0, {}).error() ==
+                  Error::RepeatedSymbol);
+  }
+
+  // JIT
+  {
+    for (const auto &M :
+         {make01s10sMachine(), makeEndInZerosMachine(),
+          makeContainsEither0100or0111(), makeContainsAbc()}) {
+      const JitMachine jit(M->compile());
+      assert(jit.isNative() == bool(FSM_HAS_JIT));
+      forEachString("01abcx", 6, [&](std::string_view str) {
+        assert(jit.accept(str) == M->accept(str));
+      });
+    }
+
+    // Random machines, over three letters, which compare against runs of
+    // bytes, and over bytes from the whole range, which need jump tables.
+    std::mt19937 random(2026);
+    std::vector<char> bytes(256);
+    for (size_t byte = 0; byte < bytes.size(); ++byte) {
+      bytes[byte] = static_cast<char>(byte);
+    }
+    size_t native = 0;
+    for (size_t round = 0; round < 200; ++round) {
+      std::string alphabet = "abc";
+      if (round % 2) {
+        std::shuffle(bytes.begin(), bytes.end(), random);
+        alphabet.assign(bytes.begin(), bytes.begin() + 40);
+      }
+      const size_t count = 1 + random() % 12;
+      Machine::state_set states;
+      Machine::state_set finalStates;
+      for (size_t state = 0; state < count; ++state) {
+        states.insert(state);
+        if (random() % 3 == 0) {
+          finalStates.insert(state);
+        }
+      }
+      Machine M(states, random() % count, finalStates);
+      for (size_t state = 0; state < count; ++state) {
+        for (const auto ch : alphabet) {
+          if (random() % 4) {
+            M.addTransition(state, ch, random() % count);
+          }
+        }
+      }
+
+      const JitMachine jit(M.compile());
+      const JitMachine interpreted(M.compile(), /*enableJit=*/false);
+      assert(!interpreted.isNative() && interpreted.codeSize() == 0);
+      native += jit.isNative();
+      for (size_t i = 0; i < 100; ++i) {
+        std::string input(random() % 24, '\0');
+        for (auto &ch : input) {
+          // Mostly symbols with transitions, sometimes any byte.
+          ch = random() % 10 ? alphabet[random() % alphabet.size()]
+                             : static_cast<char>(random());
+        }
+        const auto expected = M.accept(input);
+        assert(jit.accept(input) == expected);
+        assert(interpreted.accept(input) == expected);
+      }
+    }
+    std::cout << native << " of 200 random machines ran natively"
+              << std::endl;
+  }
+
+  // Machine files
+  {
+    const auto path =
+        (std::filesystem::temp_directory_path() / "fsm-machine-file.bin")
+            .string();
+    for (const auto &M :
+         {make01s10sMachine(), makeEndInZerosMachine(),
+          makeContainsEither0100or0111(), makeContainsAbc()}) {
+      const auto C = M->compile();
+      const auto bytes = MachineFile::serialize(C);
+      MachineFile::Error error;
+      const auto viewed =
+          MachineFile::view(bytes.data(), bytes.size(), &error);
+      assert(viewed && error == MachineFile::Error::None);
+      // Matches straight from the buffer.
+      const auto &header =
+          *reinterpret_cast<const MachineFile::Header *>(bytes.data());
+      assert(viewed->table() ==
+             reinterpret_cast<const CompiledMachine::state_id *>(
+                 bytes.data() + header.tableOffset));
+
+      assert(MachineFile::write(C, path));
+      const auto loaded = MachineFile::load(path, &error);
+      assert(loaded && error == MachineFile::Error::None);
+      assertSameMachine(*loaded, C);
+      const JitMachine jit(*loaded);
+      forEachString("01abcx", 6, [&](std::string_view str) {
+        assert(viewed->accept(str) == C.accept(str));
+        assert(loaded->accept(str) == C.accept(str));
+        assert(jit.accept(str) == C.accept(str));
+      });
+    }
+
+    // Damaged files are refused with the reason.
+    const auto C = makeContainsAbc()->compile();
+    auto refuse = [&](MachineFile::Error reason, auto damage) {
+      auto bytes = MachineFile::serialize(C);
+      auto *header = reinterpret_cast<MachineFile::Header *>(bytes.data());
+      damage(bytes, *header);
+      MachineFile::Error error;
+      assert(!MachineFile::view(bytes.data(), bytes.size(), &error));
+      assert(error == reason);
+    };
+    using Header = MachineFile::Header;
+    using Bytes = std::vector<char>;
+    refuse(MachineFile::Error::TooSmall,
+           [](Bytes &bytes, Header &) { bytes.resize(10); });
+    refuse(MachineFile::Error::BadMagic,
+           [](Bytes &, Header &header) { header.magic[0] = 'X'; });
+    refuse(MachineFile::Error::OtherEndianness, [](Bytes &, Header &header) {
+      header.endianTag = __builtin_bswap32(header.endianTag);
+    });
+    refuse(MachineFile::Error::UnsupportedVersion,
+           [](Bytes &, Header &header) { ++header.version; });
+    refuse(MachineFile::Error::Truncated,
+           [](Bytes &bytes, Header &) { bytes.pop_back(); });
+    refuse(MachineFile::Error::BadChecksum,
+           [](Bytes &bytes, Header &) { bytes[sizeof(Header) + 5] ^= 1; });
+    refuse(MachineFile::Error::BadState, [](Bytes &, Header &header) {
+      header.startState = static_cast<uint32_t>(header.stateCount);
+    });
+    refuse(MachineFile::Error::BadState,
+           [](Bytes &, Header &header) { ++header.classCount; });
+
+    // Tables that pass the checksum but break what `accept` relies on.
+    auto rewrite = [](Bytes &bytes, Header &header, auto edit) {
+      auto *classes =
+          reinterpret_cast<uint8_t *>(bytes.data() + header.classesOffset);
+      auto *table = reinterpret_cast<CompiledMachine::state_id *>(
+          bytes.data() + header.tableOffset);
+      const auto entries = header.tableSize / sizeof(*table);
+      edit(table, header.classCount);
+      header.checksum = MachineFile::checksum(classes, table, entries);
+    };
+    refuse(MachineFile::Error::BadState, [&](Bytes &bytes, Header &header) {
+      // The reject row leads to the start state.
+      rewrite(bytes, header, [&](auto *table, size_t) {
+        table[0] = header.startState;
+      });
+    });
+    refuse(MachineFile::Error::BadState, [&](Bytes &bytes, Header &header) {
+      // A transition to index 0 claims to accept.
+      rewrite(bytes, header, [](auto *table, size_t columns) {
+        table[columns] = CompiledMachine::kRejectState |
+                         CompiledMachine::kFinalFlag;
+      });
+    });
+    refuse(MachineFile::Error::BadState, [&](Bytes &bytes, Header &header) {
+      // A state is reached as dead but doesn't loop to itself.
+      rewrite(bytes, header, [](auto *table, size_t columns) {
+        table[columns] = CompiledMachine::kDeadFlag | 1;
+      });
+    });
+
+    MachineFile::Error error;
+    assert(!MachineFile::load(path + ".missing", &error));
+    assert(error == MachineFile::Error::CannotOpen);
+    std::remove(path.c_str());
+  }
+
+  // Byte classes
+  {
+    // '0', '1' and every other byte.
+    for (const auto &M : {make01s10sMachine(), makeEndInZerosMachine(),
+                          makeContainsEither0100or0111()}) {
+      const auto C = M->compile();
+      assert(C.classCount() == 3);
+      assert(C.classOf('0') != C.classOf('1'));
+      assert(C.classOf('x') == C.classOf('\xff'));
+    }
+    const auto abc = makeContainsAbc()->compile();
+    const auto stats = abc.getStats();
+    assert(stats.classes == 4);
+    assert(stats.tableBytes ==
+           256 + stats.states * stats.classes * sizeof(uint32_t));
+    assert(stats.tableBytes * 4 < stats.unclassifiedTableBytes);
+    std::cout << "abc: " << stats.states << " states, " << stats.classes
+              << " classes, " << stats.tableBytes << " bytes instead of "
+              << stats.unclassifiedTableBytes << std::endl;
+
+    // Bytes that only a wildcard reads stay together.
+    auto parser = regex::PatternParser("ab.*");
+    const auto nfa = regex::NFA(parser);
+    const auto C = regex::determinize(nfa)->compile();
+    assert(C.classCount() == 3);
+    assert(C.classOf('a') != C.classOf('b'));
+    assert(C.classOf('c') == C.classOf('\0'));
+    forEachString("abc", 6, [&](std::string_view str) {
+      assert(C.accept(str) == nfa.accept(str));
+    });
+
+    ByteClasses classes;
+    assert(classes.count() == 1);
+    classes.refine([](size_t byte) { return byte >= 'a' && byte <= 'z'; });
+    classes.refine([](size_t byte) { return byte == 'q'; });
+    assert(classes.count() == 3);
+    assert(classes['a'] == classes['z'] && classes['a'] != classes['q']);
+    assert(classes['\0'] == 0);
+    const auto representatives = classes.representatives();
+    assert(representatives[classes['q']] == 'q');
+    assert(representatives[classes['z']] == 'a');
   }
   return 0;
 }
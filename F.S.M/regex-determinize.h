@@ -0,0 +1,89 @@
+//
+//  regex-determinize.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef regex_determinize_h
+#define regex_determinize_h
+
+#include "FSM.h"
+#include "regex-matcher.h"
+#include <limits>
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace regex {
+// Builds a `Machine` accepting the same language as `nfa` with the subset
+// construction. States are numbered in breadth first order from the start
+// state, trying bytes from 0 to 255, and byte sequences that can't lead to
+// acceptance simply have no transition. Gives up with `std::nullopt` once
+// more than `maxStates` states would be needed, since the construction is
+// exponential in the worst case.
+inline std::optional<Machine>
+determinize(const NFA &nfa,
+            size_t maxStates = std::numeric_limits<size_t>::max()) {
+  using subset = std::vector<size_t>;
+
+  std::map<subset, size_t> ids;
+  std::vector<subset> subsets{{nfa.getStartState()}};
+  ids.emplace(subsets.front(), 0);
+
+  std::vector<std::vector<std::pair<char, size_t>>> transitions;
+  std::vector<bool> seen(nfa.getStateCount(), false);
+  for (size_t i = 0; i < subsets.size(); ++i) {
+    transitions.emplace_back();
+    for (size_t byte = 0; byte < 256; ++byte) {
+      const auto ch = static_cast<char>(byte);
+      subset next;
+      for (const auto state : subsets[i]) {
+        nfa.forEachNext(state, ch, [&](size_t target) {
+          if (!seen[target]) {
+            seen[target] = true;
+            next.push_back(target);
+          }
+        });
+      }
+      if (next.empty()) {
+        continue;
+      }
+      for (const auto state : next) {
+        seen[state] = false;
+      }
+      std::sort(next.begin(), next.end());
+
+      auto [it, inserted] = ids.emplace(std::move(next), subsets.size());
+      if (inserted) {
+        if (subsets.size() == maxStates) {
+          return std::nullopt;
+        }
+        subsets.push_back(it->first);
+      }
+      transitions[i].push_back({ch, it->second});
+    }
+  }
+
+  Machine::state_set states;
+  Machine::state_set finalStates;
+  for (size_t i = 0; i < subsets.size(); ++i) {
+    states.insert(i);
+    for (const auto state : subsets[i]) {
+      if (nfa.isFinalState(state)) {
+        finalStates.insert(i);
+        break;
+      }
+    }
+  }
+  Machine machine(states, /*startState=*/0, finalStates);
+  for (size_t i = 0; i < transitions.size(); ++i) {
+    for (const auto &[ch, target] : transitions[i]) {
+      machine.addTransition(i, ch, target);
+    }
+  }
+  return machine;
+}
+} // namespace regex
+
+#endif /* regex_determinize_h */
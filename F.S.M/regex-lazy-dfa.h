@@ -0,0 +1,157 @@
+//
+//  regex-lazy-dfa.h
+//  F.S.M
+//
+//  Created by Luciano Almeida on 16/10/26.
+//
+
+#ifndef regex_lazy_dfa_h
+#define regex_lazy_dfa_h
+
+#include "regex-matcher.h"
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace regex {
+
+// Runs an NFA as a DFA that is built on demand while matching.
+//
+// Every DFA state stands for a set of NFA states and is created the first
+// time a match reaches it, so a step is usually a single table lookup and
+// matching is linear in the input. States are kept in a cache bounded by a
+// memory budget. When it fills up the whole cache is flushed and rebuilt
+// from the state the current match is in.
+//
+// The cache is kept across `accept` calls so hot patterns stay warm. It is
+// not synchronized; use one instance per thread.
+class LazyDFA {
+public:
+  static constexpr size_t kDefaultMemoryBudget = 1 << 20;
+
+  struct Stats {
+    size_t cacheMisses = 0;
+    size_t flushes = 0;
+    size_t states = 0;
+    size_t memory = 0;
+  };
+
+private:
+  using state_id = uint32_t;
+  using state_set = std::vector<size_t>;
+
+  static constexpr state_id kUnknown = UINT32_MAX;
+  // The empty set, every transition from it loops back.
+  static constexpr state_id kDeadState = 0;
+  static constexpr size_t kAlphabetSize = 256;
+
+  struct SetHash {
+    size_t operator()(const state_set &set) const noexcept {
+      size_t hash = set.size();
+      for (const auto state : set) {
+        hash ^= state + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+      }
+      return hash;
+    }
+  };
+
+  NFA mNFA;
+  size_t mMemoryBudget;
+
+  std::vector<state_set> mSets;
+  std::vector<bool> mFinal;
+  std::vector<state_id> mTransitions;
+  std::unordered_map<state_set, state_id, SetHash> mIds;
+  state_id mStartState = kDeadState;
+  state_set mScratch;
+  Stats mStats;
+
+  static size_t costOf(const state_set &set) noexcept {
+    return kAlphabetSize * sizeof(state_id) + set.size() * sizeof(size_t) * 2 +
+           sizeof(state_set) * 2;
+  }
+
+  state_id intern(const state_set &set) {
+    const auto [it, inserted] =
+        mIds.emplace(set, static_cast<state_id>(mSets.size()));
+    if (!inserted) {
+      return it->second;
+    }
+    bool final = false;
+    for (const auto state : set) {
+      final = final || mNFA.isFinalState(state);
+    }
+    mSets.push_back(set);
+    mFinal.push_back(final);
+    mTransitions.resize(mTransitions.size() + kAlphabetSize,
+                        set.empty() ? kDeadState : kUnknown);
+    mStats.memory += costOf(set);
+    mStats.states = mSets.size();
+    return it->second;
+  }
+
+  void flush() {
+    mSets.clear();
+    mFinal.clear();
+    mTransitions.clear();
+    mIds.clear();
+    mStats.memory = 0;
+    ++mStats.flushes;
+    intern({});
+    mStartState = intern({mNFA.getStartState()});
+  }
+
+  state_id computeNext(state_id from, unsigned char ch) {
+    ++mStats.cacheMisses;
+    mScratch.clear();
+    for (const auto state : mSets[from]) {
+      mNFA.forEachNext(state, static_cast<char>(ch),
+                       [this](size_t next) { mScratch.push_back(next); });
+    }
+    std::sort(mScratch.begin(), mScratch.end());
+    mScratch.erase(std::unique(mScratch.begin(), mScratch.end()),
+                   mScratch.end());
+
+    if (!mIds.count(mScratch) &&
+        mStats.memory + costOf(mScratch) > mMemoryBudget) {
+      // Keep the state being matched from across the flush.
+      auto fromSet = mSets[from];
+      flush();
+      from = intern(fromSet);
+    }
+    const auto next = intern(mScratch);
+    mTransitions[from * kAlphabetSize + ch] = next;
+    return next;
+  }
+
+public:
+  explicit LazyDFA(NFA nfa, size_t memoryBudget = kDefaultMemoryBudget)
+      : mNFA(std::move(nfa)), mMemoryBudget(memoryBudget) {
+    flush();
+    mStats.flushes = 0;
+  }
+
+  bool accept(std::string_view input) {
+    auto curState = mStartState;
+    for (const auto ch : input) {
+      const auto byte = static_cast<unsigned char>(ch);
+      auto next = mTransitions[curState * kAlphabetSize + byte];
+      if (next == kUnknown) {
+        next = computeNext(curState, byte);
+      }
+      if (next == kDeadState) {
+        return false;
+      }
+      curState = next;
+    }
+    return mFinal[curState];
+  }
+
+  const Stats &getStats() const noexcept { return mStats; }
+};
+
+} // namespace regex
+
+#endif /* regex_lazy_dfa_h */
@@ -9,18 +9,60 @@
 #ifndef regex_matcher_h
 #define regex_matcher_h
 
+#include "Probe.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <variant>
 #include <vector>
 
-template <>
-struct std::hash<std::pair<size_t, size_t>> {
-  std::size_t operator()(const std::pair<size_t, size_t> &k) const {
-    return std::hash<size_t>()(k.first) ^ std::hash<size_t>()(k.second);
+namespace regex {
+// Per-thread scratch memory reused across matches, so steady state matching
+// does not allocate once the buffer has grown to the largest input seen.
+class ScratchArena {
+public:
+  struct Stats {
+    size_t highWaterBytes = 0;
+    size_t growths = 0;
+    size_t uses = 0;
+  };
+
+private:
+  std::vector<uint64_t> mBuffer;
+  Stats mStats;
+
+public:
+  static ScratchArena &local() {
+    thread_local ScratchArena arena;
+    return arena;
   }
+
+  // Returns `count` zeroed words, valid until the next call on this arena.
+  uint64_t *zeroedWords(size_t count) {
+    ++mStats.uses;
+    if (count > mBuffer.size()) {
+      mBuffer.resize(count);
+      ++mStats.growths;
+      mStats.highWaterBytes = count * sizeof(uint64_t);
+    }
+    std::fill_n(mBuffer.data(), count, 0);
+    return mBuffer.data();
+  }
+
+  const Stats &getStats() const noexcept { return mStats; }
 };
 
-namespace regex {
 class Token {
 protected:
   char mValue;
@@ -60,17 +102,49 @@ class NFA {
   using symbol_transition_map =
       std::unordered_map<char, std::unordered_set<size_t>>;
   using transition_map = std::unordered_map<size_t, symbol_transition_map>;
-  using state_attempt_set = std::unordered_set<std::pair<size_t, size_t>>;
 
-  size_t mStartState{0};
-  transition_map mTransitions;
-  std::set<size_t> mFinalStates;
+  // Dense `states x (input length + 1)` bit matrix of the (state, position)
+  // pairs already known not to lead to acceptance.
+  struct RejectedAttempts {
+    uint64_t *bits;
+    size_t columns;
 
-  void addTransition(Token token, size_t from, size_t to) {
-    mTransitions[from][token.getValue()].insert(to);
+    bool test(size_t state, size_t idx) const noexcept {
+      const auto bit = state * columns + idx;
+      return (bits[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    void set(size_t state, size_t idx) noexcept {
+      const auto bit = state * columns + idx;
+      bits[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+  };
+
+  struct Edge {
+    char symbol;
+    size_t target;
+  };
+
+  size_t mStartState{0};
+  size_t mStateCount{0};
+
+  // Transitions are frozen after construction in compressed sparse row form.
+  // The edges leaving state `s` are `mEdges[mEdgeOffsets[s]]` up to
+  // `mEdges[mEdgeOffsets[s + 1]]`, sorted by symbol, and its "." targets are
+  // laid out the same way in `mWildcardTargets`.
+  std::vector<size_t> mEdgeOffsets;
+  std::vector<Edge> mEdges;
+  std::vector<size_t> mWildcardOffsets;
+  std::vector<size_t> mWildcardTargets;
+  std::vector<bool> mFinalStates;
+
+  static void addTransition(transition_map &transitions, Token token,
+                            size_t from, size_t to) {
+    transitions[from][token.getValue()].insert(to);
   }
 
-  void addZeroOrMoreSequenceTransitions(
+  static void addZeroOrMoreSequenceTransitions(
+      transition_map &transitions,
       const std::vector<std::pair<size_t, Token>> &zeroOrMoreStates) {
     if (zeroOrMoreStates.size() <= 2) {
       return;
@@ -82,13 +156,69 @@ class NFA {
       for (size_t j = i + 2; j < zeroOrMoreStates.size(); ++j) {
         const auto &[stateI, _] = zeroOrMoreStates[i];
         const auto &[stateJ, tokenJ] = zeroOrMoreStates[j];
-        addTransition(tokenJ, stateI, stateJ);
+        addTransition(transitions, tokenJ, stateI, stateJ);
+      }
+    }
+  }
+
+  void freeze(const transition_map &transitions,
+              const std::set<size_t> &finalStates) {
+    mEdgeOffsets.assign(1, 0);
+    mWildcardOffsets.assign(1, 0);
+    for (size_t state = 0; state < mStateCount; ++state) {
+      const auto it = transitions.find(state);
+      if (it != transitions.end()) {
+        const auto edgesBegin = mEdges.size();
+        const auto wildcardsBegin = mWildcardTargets.size();
+        for (const auto &[symbol, targets] : it->second) {
+          for (const auto target : targets) {
+            if (symbol == '.') {
+              mWildcardTargets.push_back(target);
+            } else {
+              mEdges.push_back({symbol, target});
+            }
+          }
+        }
+        std::sort(mEdges.begin() + edgesBegin, mEdges.end(),
+                  [](const Edge &lhs, const Edge &rhs) {
+                    return std::make_pair(lhs.symbol, lhs.target) <
+                           std::make_pair(rhs.symbol, rhs.target);
+                  });
+        std::sort(mWildcardTargets.begin() + wildcardsBegin,
+                  mWildcardTargets.end());
       }
+      mEdgeOffsets.push_back(mEdges.size());
+      mWildcardOffsets.push_back(mWildcardTargets.size());
+    }
+
+    mFinalStates.assign(mStateCount, false);
+    for (const auto state : finalStates) {
+      mFinalStates[state] = true;
     }
   }
 
+  // The targets of `state` on exactly `ch`, not counting "." transitions.
+  std::pair<const Edge *, const Edge *> edgesOn(size_t state,
+                                                char ch) const noexcept {
+    const auto *begin = mEdges.data() + mEdgeOffsets[state];
+    const auto *end = mEdges.data() + mEdgeOffsets[state + 1];
+    return std::equal_range(
+        begin, end, Edge{ch, 0},
+        [](const Edge &lhs, const Edge &rhs) {
+          return lhs.symbol < rhs.symbol;
+        });
+  }
+
+  std::pair<const size_t *, const size_t *>
+  wildcardsOf(size_t state) const noexcept {
+    return {mWildcardTargets.data() + mWildcardOffsets[state],
+            mWildcardTargets.data() + mWildcardOffsets[state + 1]};
+  }
+
 public:
   NFA(PatternParser &parser) {
+    transition_map transitions;
+    std::set<size_t> finalStates;
     auto curState = mStartState;
     std::optional<size_t> lastRequiredState;
     std::vector<std::pair<size_t, Token>> zeroOrMoreStates;
@@ -100,33 +230,33 @@ public:
         if (curState == mStartState) {
           lastRequiredState = curState;
         }
-        addTransition(token, curState, curState + 1);
+        addTransition(transitions, token, curState, curState + 1);
         ++curState;
-        addTransition(token, curState, curState);
+        addTransition(transitions, token, curState, curState);
         zeroOrMoreStates.push_back({curState, token});
 
         // For each required state before a sequence of
         // optional ones, add a transiton from it to all
         // in that sequence to allow for skiping each state.
         if (lastRequiredState.has_value()) {
-          addTransition(token, *lastRequiredState, curState);
+          addTransition(transitions, token, *lastRequiredState, curState);
         }
       } else {
-        addTransition(token, curState, curState + 1);
+        addTransition(transitions, token, curState, curState + 1);
         // Add for each optional previous state a transition
         // to the next required, so each of then can be skipped.
         for (const auto &[state, _] : zeroOrMoreStates) {
-          addTransition(token, state, curState + 1);
+          addTransition(transitions, token, state, curState + 1);
         }
 
         // A transition so sequence of optional states can be skipped.
         if (lastRequiredState.has_value()) {
-          addTransition(token, *lastRequiredState, curState + 1);
+          addTransition(transitions, token, *lastRequiredState, curState + 1);
         }
 
         // All optinal states have a state transition that skips the
         // next one.
-        addZeroOrMoreSequenceTransitions(zeroOrMoreStates);
+        addZeroOrMoreSequenceTransitions(transitions, zeroOrMoreStates);
 
         zeroOrMoreStates.clear();
         ++curState;
@@ -138,71 +268,113 @@ public:
 
     // All optinal states have a state transition that skips the
     // next one.
-    addZeroOrMoreSequenceTransitions(zeroOrMoreStates);
+    addZeroOrMoreSequenceTransitions(transitions, zeroOrMoreStates);
 
     // Machine finishes with a sequence of one or more
     // states which are all final states.
     if (!zeroOrMoreStates.empty()) {
       for (const auto &[state, _] : zeroOrMoreStates) {
-        mFinalStates.insert(state);
+        finalStates.insert(state);
       }
       if (lastRequiredState.has_value()) {
-        mFinalStates.insert(*lastRequiredState);
+        finalStates.insert(*lastRequiredState);
       }
     } else {
-      mFinalStates.insert(curState);
+      finalStates.insert(curState);
     }
+    mStateCount = curState + 1;
+    freeze(transitions, finalStates);
   }
 
-  bool accept(std::string_view input) {
-    state_attempt_set rejectedStates;
-    return acceptImpl(input, mStartState, 0, rejectedStates);
+  size_t getStartState() const noexcept { return mStartState; }
+  size_t getStateCount() const noexcept { return mStateCount; }
+
+  bool isFinalState(size_t state) const noexcept {
+    return mFinalStates[state];
   }
 
-  void dump() {
-    for (const auto &entry : mTransitions) {
-      std::cout << entry.first << ": ";
-      for (const auto &tentry : entry.second) {
-        for (const auto state : tentry.second) {
-          std::cout << "{ " << tentry.first << ", " << state << "}";
-        }
+  // Calls `fn` with every state reachable from `state` reading `ch`.
+  template <class Fn>
+  void forEachNext(size_t state, char ch, Fn fn) const {
+    const auto [wildcardsBegin, wildcardsEnd] = wildcardsOf(state);
+    for (auto it = wildcardsBegin; it != wildcardsEnd; ++it) {
+      fn(*it);
+    }
+    const auto [edgesBegin, edgesEnd] = edgesOn(state, ch);
+    for (auto it = edgesBegin; it != edgesEnd; ++it) {
+      fn(it->target);
+    }
+  }
+
+  bool accept(std::string_view input) const {
+    NullProbe probe;
+    return accept(input, probe);
+  }
+
+  // Accepts like `accept(input)`, reporting every step of the search to
+  // `probe`.
+  template <class Probe>
+  bool accept(std::string_view input, Probe &probe) const {
+    const auto columns = input.size() + 1;
+    auto *bits =
+        ScratchArena::local().zeroedWords((mStateCount * columns + 63) / 64);
+    RejectedAttempts rejectedStates{bits, columns};
+    return acceptImpl(input, mStartState, 0, rejectedStates, probe);
+  }
+
+  void dump() const {
+    for (size_t state = 0; state < mStateCount; ++state) {
+      std::cout << state << ": ";
+      const auto [wildcardsBegin, wildcardsEnd] = wildcardsOf(state);
+      for (auto it = wildcardsBegin; it != wildcardsEnd; ++it) {
+        std::cout << "{ ., " << *it << "}";
+      }
+      for (auto i = mEdgeOffsets[state]; i < mEdgeOffsets[state + 1]; ++i) {
+        std::cout << "{ " << mEdges[i].symbol << ", " << mEdges[i].target
+                  << "}";
       }
       std::cout << std::endl;
     }
 
     std::cout << "F: ";
-    for (const auto fstate : mFinalStates) {
-      std::cout << fstate << " ";
+    for (size_t state = 0; state < mStateCount; ++state) {
+      if (mFinalStates[state]) {
+        std::cout << state << " ";
+      }
     }
     std::cout << std::endl;
   }
 
 private:
+  template <class Probe>
   bool acceptImpl(std::string_view input, size_t curState, size_t idx,
-                  state_attempt_set &rejectedStates) {
+                  RejectedAttempts &rejectedStates, Probe &probe) const {
+    probe.visit(curState);
     // We read all input string.
     if (idx == input.size()) {
-      return bool(mFinalStates.count(curState));
+      return mFinalStates[curState];
     }
 
     const auto inputChar = input[idx];
 
-    auto &curStateTransitions = mTransitions[curState];
-
-    auto attemptNext = [this, &rejectedStates, &input, &idx](size_t next) {
+    auto attemptNext = [this, &rejectedStates, &input, &idx, curState,
+                        &probe](size_t next) {
       // Memoization of attempted and rejected states for a given input
       // position and a next state. Is like a graph, if we did already
       // traverse that path for a given point and know that it isn't
       // accepted we don't need to go again.
-      auto attempt = std::make_pair(next, idx + 1);
-      if (rejectedStates.count(attempt))
+      if (rejectedStates.test(next, idx + 1)) {
+        probe.memoHit(next);
         return false;
+      }
 
-      if (acceptImpl(input, next, idx + 1, rejectedStates)) {
+      probe.transition(curState, next);
+      if (acceptImpl(input, next, idx + 1, rejectedStates, probe)) {
         return true;
       }
 
-      rejectedStates.insert(attempt);
+      probe.backtrack(next);
+      rejectedStates.set(next, idx + 1);
       return false;
     };
 
@@ -210,14 +382,16 @@ private:
     // Attempt each possible transition to account for non-determinism.
     
     // Transitions for specific any symbol ".".
-    for (size_t next : curStateTransitions['.']) {
-      if (attemptNext(next))
+    const auto [wildcardsBegin, wildcardsEnd] = wildcardsOf(curState);
+    for (auto it = wildcardsBegin; it != wildcardsEnd; ++it) {
+      if (attemptNext(*it))
         return true;
     }
 
     // Transitions for specific input symbol.
-    for (size_t next : curStateTransitions[inputChar]) {
-      if (attemptNext(next))
+    const auto [edgesBegin, edgesEnd] = edgesOn(curState, inputChar);
+    for (auto it = edgesBegin; it != edgesEnd; ++it) {
+      if (attemptNext(it->target))
         return true;
     }
 
@@ -225,12 +399,364 @@ private:
   }
 };
 
+// Bit-parallel (Shift-And) matcher over the Glushkov automaton of a pattern.
+//
+// Bit `i` of the state is set when the input read so far can match the first
+// `i` tokens, so the whole set of active NFA states fits in one word and is
+// updated with a few shifts and masks per byte. Starred tokens can also be
+// skipped, which is an epsilon closure over runs of starred tokens computed
+// with a logarithmic number of shifts.
+class ShiftAndMatcher {
+public:
+  static constexpr size_t kMaxTokens = 63;
+
+private:
+  // Enough closure rounds for a run of `kMaxTokens` starred tokens.
+  static constexpr size_t kMaxClosureRounds = 6;
+
+  std::array<uint64_t, 256> mMasks{};
+  uint64_t mStarred = 0;
+  uint64_t mAccept = 0;
+  uint64_t mStart = 0;
+  // `mPropagate[k]` has bit `i` set when tokens `i - 2^k + 1` to `i` are all
+  // starred, which lets round `k` move bits `2^k` positions at once.
+  std::array<uint64_t, kMaxClosureRounds> mPropagate{};
+  size_t mClosureRounds = 0;
+
+  uint64_t closure(uint64_t state) const noexcept {
+    for (size_t k = 0; k < mClosureRounds; ++k) {
+      state |= (state << (size_t(1) << k)) & mPropagate[k];
+    }
+    return state;
+  }
+
+public:
+  static bool fits(const std::vector<Token> &tokens) noexcept {
+    return tokens.size() <= kMaxTokens;
+  }
+
+  explicit ShiftAndMatcher(const std::vector<Token> &tokens) {
+    assert(fits(tokens) && "Pattern too long for a single word");
+    size_t run = 0;
+    size_t longestRun = 0;
+    for (size_t t = 0; t < tokens.size(); ++t) {
+      const auto bit = uint64_t(1) << (t + 1);
+      if (tokens[t].getValue() == '.') {
+        for (auto &mask : mMasks) {
+          mask |= bit;
+        }
+      } else {
+        mMasks[static_cast<unsigned char>(tokens[t].getValue())] |= bit;
+      }
+      if (tokens[t].isZeroOrMore()) {
+        mStarred |= bit;
+        longestRun = std::max(longestRun, ++run);
+      } else {
+        run = 0;
+      }
+    }
+
+    auto propagate = mStarred;
+    while ((size_t(1) << mClosureRounds) <= longestRun) {
+      mPropagate[mClosureRounds] = propagate;
+      propagate &= propagate << (size_t(1) << mClosureRounds);
+      ++mClosureRounds;
+    }
+    mAccept = uint64_t(1) << tokens.size();
+    mStart = closure(1);
+  }
+
+  bool accept(std::string_view input) const noexcept {
+    auto state = mStart;
+    for (const auto ch : input) {
+      state = step(state, ch);
+      if (state == 0) {
+        return false;
+      }
+    }
+    return state & mAccept;
+  }
+
+  // Returns the length of the shortest prefix of `input` matching the whole
+  // pattern, or `std::string_view::npos` when there is none.
+  size_t shortestPrefix(std::string_view input) const noexcept {
+    auto state = mStart;
+    for (size_t i = 0; state != 0; ++i) {
+      if (state & mAccept) {
+        return i;
+      }
+      if (i == input.size()) {
+        break;
+      }
+      state = step(state, input[i]);
+    }
+    return std::string_view::npos;
+  }
+
+private:
+  uint64_t step(uint64_t state, char ch) const noexcept {
+    const auto mask = mMasks[static_cast<unsigned char>(ch)];
+    return closure(((state << 1) | (state & mStarred)) & mask);
+  }
+};
+
+// Multi-word variant of `ShiftAndMatcher` for patterns of any length.
+class WideShiftAndMatcher {
+  using words = std::vector<uint64_t>;
+
+  size_t mWordCount;
+  // Token masks for each byte, `mWordCount` words each.
+  words mMasks;
+  words mStarred;
+  words mStart;
+  size_t mAcceptToken;
+  std::vector<words> mPropagate;
+
+  // dst = (src << shift) & mask, across word boundaries.
+  void shiftLeftAnd(const uint64_t *src, size_t shift, const uint64_t *mask,
+                    uint64_t *dst) const noexcept {
+    const auto wordShift = shift / 64;
+    const auto bitShift = shift % 64;
+    for (size_t w = mWordCount; w-- > 0;) {
+      uint64_t word = 0;
+      if (w >= wordShift) {
+        word = src[w - wordShift] << bitShift;
+        if (bitShift != 0 && w > wordShift) {
+          word |= src[w - wordShift - 1] >> (64 - bitShift);
+        }
+      }
+      dst[w] = word & mask[w];
+    }
+  }
+
+  void closure(uint64_t *state, uint64_t *scratch) const noexcept {
+    for (size_t k = 0; k < mPropagate.size(); ++k) {
+      shiftLeftAnd(state, size_t(1) << k, mPropagate[k].data(), scratch);
+      for (size_t w = 0; w < mWordCount; ++w) {
+        state[w] |= scratch[w];
+      }
+    }
+  }
+
+public:
+  explicit WideShiftAndMatcher(const std::vector<Token> &tokens)
+      : mWordCount((tokens.size() + 1 + 63) / 64),
+        mMasks(256 * mWordCount, 0), mStarred(mWordCount, 0),
+        mStart(mWordCount, 0), mAcceptToken(tokens.size()) {
+    auto setBit = [](uint64_t *bits, size_t i) {
+      bits[i / 64] |= uint64_t(1) << (i % 64);
+    };
+
+    size_t run = 0;
+    size_t longestRun = 0;
+    for (size_t t = 0; t < tokens.size(); ++t) {
+      for (size_t ch = 0; ch < 256; ++ch) {
+        if (tokens[t].getValue() == '.' ||
+            static_cast<unsigned char>(tokens[t].getValue()) == ch) {
+          setBit(&mMasks[ch * mWordCount], t + 1);
+        }
+      }
+      if (tokens[t].isZeroOrMore()) {
+        setBit(mStarred.data(), t + 1);
+        longestRun = std::max(longestRun, ++run);
+      } else {
+        run = 0;
+      }
+    }
+
+    auto propagate = mStarred;
+    words shifted(mWordCount);
+    while ((size_t(1) << mPropagate.size()) <= longestRun) {
+      const auto shift = size_t(1) << mPropagate.size();
+      mPropagate.push_back(propagate);
+      shiftLeftAnd(propagate.data(), shift, propagate.data(), shifted.data());
+      propagate = shifted;
+    }
+
+    words scratch(mWordCount);
+    setBit(mStart.data(), 0);
+    closure(mStart.data(), scratch.data());
+  }
+
+  bool accept(std::string_view input) const {
+    auto *state = run(input, /*stopAtAccept=*/false).first;
+    return state && isAccepting(state);
+  }
+
+  // Returns the length of the shortest prefix of `input` matching the whole
+  // pattern, or `std::string_view::npos` when there is none.
+  size_t shortestPrefix(std::string_view input) const {
+    const auto [state, length] = run(input, /*stopAtAccept=*/true);
+    return state && isAccepting(state) ? length : std::string_view::npos;
+  }
+
+private:
+  bool isAccepting(const uint64_t *state) const noexcept {
+    return (state[mAcceptToken / 64] >> (mAcceptToken % 64)) & 1;
+  }
+
+  // Runs over `input` and returns the final state and the number of bytes
+  // read, or a null state once no token can match anymore. The state lives
+  // in the thread's scratch arena.
+  std::pair<const uint64_t *, size_t> run(std::string_view input,
+                                          bool stopAtAccept) const {
+    auto *buffer = ScratchArena::local().zeroedWords(3 * mWordCount);
+    auto *state = buffer;
+    auto *next = buffer + mWordCount;
+    auto *scratch = buffer + 2 * mWordCount;
+    std::copy(mStart.begin(), mStart.end(), state);
+
+    for (size_t i = 0;; ++i) {
+      if (i == input.size() || (stopAtAccept && isAccepting(state))) {
+        return {state, i};
+      }
+      const auto *mask =
+          &mMasks[static_cast<unsigned char>(input[i]) * mWordCount];
+      // next = ((state << 1) | (state & starred)) & mask
+      shiftLeftAnd(state, 1, mask, next);
+      uint64_t any = 0;
+      for (size_t w = 0; w < mWordCount; ++w) {
+        next[w] |= state[w] & mStarred[w] & mask[w];
+        any |= next[w];
+      }
+      if (any == 0) {
+        return {nullptr, i + 1};
+      }
+      closure(next, scratch);
+      std::swap(state, next);
+    }
+  }
+};
+
+// A pattern compiled to the fastest engine that fits it. Matching is read
+// only, so one instance can be shared by any number of threads.
+class CompiledPattern {
+  // Patterns longer than this use the NFA. The wide matcher's bitsets are a
+  // bit per token: it keeps one for each of the 256 bytes, 128 KiB at this
+  // many tokens, and every step shifts and masks the whole width, so the
+  // cutoff bounds its memory and its cost per byte.
+  static constexpr size_t kMaxWideTokens = 4096;
+
+  std::variant<ShiftAndMatcher, WideShiftAndMatcher, NFA> mEngine;
+
+  static decltype(mEngine) makeEngine(const std::string &pattern) {
+    std::vector<Token> tokens;
+    auto tokenizer = PatternParser(pattern);
+    while (tokenizer.canGet()) {
+      tokens.push_back(tokenizer.next());
+    }
+
+    if (ShiftAndMatcher::fits(tokens)) {
+      return ShiftAndMatcher(tokens);
+    }
+    if (tokens.size() <= kMaxWideTokens) {
+      return WideShiftAndMatcher(tokens);
+    }
+    auto parser = PatternParser(pattern);
+    return NFA(parser);
+  }
+
+public:
+  explicit CompiledPattern(const std::string &pattern)
+      : mEngine(makeEngine(pattern)) {}
+
+  bool accept(std::string_view input) const {
+    return std::visit(
+        [input](const auto &engine) { return engine.accept(input); }, mEngine);
+  }
+};
+
+// Thread-safe, bounded LRU cache of compiled patterns keyed by the pattern
+// string. Handles stay valid after their entry is evicted.
+class PatternCache {
+public:
+  static constexpr size_t kDefaultCapacity = 256;
+
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+  };
+
+private:
+  using entry = std::pair<std::string, std::shared_ptr<const CompiledPattern>>;
+
+  size_t mCapacity;
+  mutable std::mutex mMutex;
+  // Most recently used first.
+  std::list<entry> mEntries;
+  std::unordered_map<std::string_view, std::list<entry>::iterator> mIndex;
+  Stats mStats;
+
+  // Expects `mMutex` to be held.
+  std::shared_ptr<const CompiledPattern> lookup(const std::string &pattern) {
+    const auto it = mIndex.find(pattern);
+    if (it == mIndex.end()) {
+      return nullptr;
+    }
+    mEntries.splice(mEntries.begin(), mEntries, it->second);
+    return it->second->second;
+  }
+
+public:
+  explicit PatternCache(size_t capacity = kDefaultCapacity)
+      : mCapacity(std::max<size_t>(capacity, 1)) {}
+
+  // The cache used by `Solution::isMatch`.
+  static PatternCache &shared() {
+    static PatternCache cache;
+    return cache;
+  }
+
+  std::shared_ptr<const CompiledPattern> get(const std::string &pattern) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (auto compiled = lookup(pattern)) {
+        ++mStats.hits;
+        return compiled;
+      }
+      ++mStats.misses;
+    }
+
+    // Compile without holding the lock so other patterns aren't blocked.
+    auto compiled = std::make_shared<const CompiledPattern>(pattern);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (auto existing = lookup(pattern)) {
+      // Another thread compiled it in the meantime.
+      return existing;
+    }
+    mEntries.emplace_front(pattern, compiled);
+    mIndex.emplace(mEntries.front().first, mEntries.begin());
+    if (mEntries.size() > mCapacity) {
+      mIndex.erase(mEntries.back().first);
+      mEntries.pop_back();
+      ++mStats.evictions;
+    }
+    return compiled;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mEntries.size();
+  }
+
+  Stats getStats() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats;
+  }
+};
+
 class Solution {
 public:
   bool isMatch(const std::string &s, std::string p) {
-    auto parser = PatternParser(std::move(p));
-    auto SM = NFA(parser);
-    return SM.accept(s);
+    return compile(p)->accept(s);
+  }
+
+  // Returns the compiled form of a pattern, for callers that match it many
+  // times and want to skip the cache lookup.
+  std::shared_ptr<const CompiledPattern> compile(const std::string &pattern) {
+    return PatternCache::shared().get(pattern);
   }
 };
 } // namespace regex